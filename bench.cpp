@@ -0,0 +1,121 @@
+/*
+Copyright (C) 2021-2025  Sungbae Jeong
+
+This file is distributed under the same license as clparse.h.
+
+//////////////////////////////////////////////////////////////////////////////
+
+A benchmark of clparse.hpp against the C API of clparse.h
+
+    c++ -std=c++17 -O2 -I. bench.cpp -o bench && ./bench [ROUNDS]
+
+Each round registers the same flags, parses the same argv, reads every value
+and deinits, once through the C API and once through clparse::Parser. Both
+sides are in this file, so both convert numbers with std::from_chars; what is
+measured is the cost of the wrapper itself (Expected, Value, List and Span).
+*/
+
+#define CLPARSE_IMPLEMENTATION
+#include <clparse.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#define LIST_LEN 4096
+
+// keeps the compiler from dropping what is read
+static volatile std::uint64_t sink;
+
+static std::uint64_t runC(int argc, cchar** argv) {
+    std::uint64_t sum = 0;
+
+    clparseInit(CSTR("bench"), CSTR("C API"));
+    const int32_t* num = clparseI32(CSTR("num"), CSTR('n'), 0, CSTR("a number"), NO_SUBCMD);
+    const bool* verbose = clparseBool(CSTR("verbose"), CSTR('v'), false, CSTR("verbose"), NO_SUBCMD);
+    const cchar** name = clparseStr(CSTR("name"), NO_SHORT, NULL, CSTR("a name"), NO_SUBCMD);
+    const ArrayList* ids = clparseU32List(CSTR("ids"), CSTR('i'), 0, CSTR("ids"), NO_SUBCMD);
+    const cchar** file = clparseMainArg(CSTR("FILE"), CSTR("a file"), NO_SUBCMD);
+
+    if (!clparseParse(argc, argv)) {
+        std::fprintf(stderr, "C API: %s\n", clparseGetErr());
+        std::exit(1);
+    }
+
+    sum += (std::uint64_t)*num + *verbose + cstrlen(*name) + cstrlen(*file);
+    for (size_t i = 0; i < ids->len; ++i) sum += ((const uint32_t*)ids->items)[i];
+
+    clparseDeinit();
+    return sum;
+}
+
+static std::uint64_t runCpp(int argc, cchar** argv) {
+    std::uint64_t sum = 0;
+
+    clparse::Parser parser(CSTR("bench"), CSTR("clparse.hpp"));
+    auto num = parser.flag<std::int32_t>(CSTR("num"), CSTR('n'), 0, CSTR("a number"));
+    auto verbose = parser.flag<bool>(CSTR("verbose"), CSTR('v'), false, CSTR("verbose"));
+    auto name = parser.flag<const cchar*>(CSTR("name"), NO_SHORT, nullptr, CSTR("a name"));
+    auto ids = parser.list<std::uint32_t>(CSTR("ids"), CSTR('i'), CSTR("ids"));
+    auto file = parser.mainArg(CSTR("FILE"), CSTR("a file"));
+
+    if (auto res = parser.parse(argc, argv); !res) {
+        std::fprintf(stderr, "clparse.hpp: %s\n", res.error().message);
+        std::exit(1);
+    }
+
+    sum += static_cast<std::uint64_t>(num->get()) + verbose->get() + name->get().size() +
+           file->get().size();
+    for (std::uint32_t id : ids->get()) sum += id;
+
+    return sum;
+}
+
+template <typename F>
+static double measure(const char* label, int rounds, F run) {
+    std::uint64_t sum = 0;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i) sum += run();
+    auto end = std::chrono::steady_clock::now();
+
+    sink = sum;
+    double ns = std::chrono::duration<double, std::nano>(end - begin).count() / rounds;
+    std::printf("%-12s %12.1f ns/round\n", label, ns);
+    return ns;
+}
+
+int main(int argc, char** argv) {
+    int rounds = argc > 1 ? std::atoi(argv[1]) : 2000;
+    if (rounds <= 0) rounds = 2000;
+
+    // `bench file -n 42 -v --name foo --ids 0,1,...,4095`
+    std::basic_string<cchar> ids;
+    for (int i = 0; i < LIST_LEN; ++i) {
+        if (i > 0) ids += CSTR(',');
+        for (cchar ch : std::to_string(i)) ids += ch;
+    }
+
+    std::vector<cchar*> args;
+    const cchar* words[] = {
+        CSTR("bench"), CSTR("file"), CSTR("-n"), CSTR("42"), CSTR("-v"),
+        CSTR("--name"), CSTR("foo"), CSTR("--ids"), ids.c_str(),
+    };
+    // clparse never writes into argv strings
+    for (const cchar* word : words) args.push_back(const_cast<cchar*>(word));
+    int bench_argc = static_cast<int>(args.size());
+
+    // warm up, and check that both read the same values
+    if (runC(bench_argc, args.data()) != runCpp(bench_argc, args.data())) {
+        std::fprintf(stderr, "the C API and clparse.hpp disagree\n");
+        return 1;
+    }
+
+    double c_ns = measure("C API", rounds, [&] { return runC(bench_argc, args.data()); });
+    double cpp_ns = measure("clparse.hpp", rounds, [&] { return runCpp(bench_argc, args.data()); });
+    std::printf("clparse.hpp / C API: %.3f\n", cpp_ns / c_ns);
+
+    return 0;
+}
@@ -46,7 +46,7 @@ It is a command line parser inspired by go's flag module and tsodings flag.h
 #endif // CLPDEF
 
 // Windows uses UTF-16 for argv in default
-#if defined(_WIN32) && !defined(NO_USE_WIDE_ARGV)
+#if defined(_WIN32) && !defined(NO_USE_WIDE_ARGV) && !defined(USE_UTF8_ARGV)
 #define USE_WIDE_ARGV
 #endif
 
@@ -74,6 +74,33 @@ It is a command line parser inspired by go's flag module and tsodings flag.h
 //
 // * NOT_ALLOW_EMPTY_ARGUMENT
 // If this macro turns on, then clparse disallows the empty argument and emit an error
+// * CLPARSE_SPLIT_STRING_LISTS
+// String lists split comma separated values (`--tags a,b`) as the other lists
+// do, into copies since argv is never written. Without it, each token is one
+// item, so values such as file names may contain commas.
+// * USE_UTF8_ARGV
+// On windows, clparse works on UTF-8 instead of UTF-16. Get argv with
+// clparseGetCmdlineUtf8, which transcodes the whole command line at once.
+// * CLPARSE_PARSE_INTEGER(str, end, output)
+// Overrides the number conversion of flags. It has the same contract as
+// `strtoull(str, end, 0)` except that it returns false on failure instead of
+// setting errno. clparse.hpp uses it to plug std::from_chars in.
+// * CLPARSE_PARALLEL
+// On POSIX, numeric lists with at least CLPARSE_PARALLEL_THRESHOLD (65536) items
+// in one occurrence are converted by up to CLPARSE_PARALLEL_THREADS (8) threads.
+// Link with pthread. CLPARSE_PARSE_INTEGER must be thread safe then.
+// * CLPARSE_PREFETCH
+// On POSIX (without USE_WIDE_ARGV), adds path flags whose files are opened and
+// read ahead on a background thread while parsing goes on. Link with pthread.
+// A strict `-std=` hides POSIX.1-2008, so define _POSIX_C_SOURCE as 200809L
+// (before any include) for O_CLOEXEC and the readahead; without them, paths are
+// still opened but not read ahead.
+// * CLPARSE_TRACE
+// On POSIX, adds static probes (provider `clparse`) through <sys/sdt.h> when it
+// exists, and clparseTraceTo which records Chrome trace events. Without it,
+// every probe compiles to nothing. Timestamps come from CLOCK_MONOTONIC, or
+// from C11 timespec_get when POSIX.1-2008 is hidden (see CLPARSE_PREFETCH),
+// or from clock() before C11. Flag names are escaped in the trace.
 // * NO_SHORT
 // Default value of the short flag name
 // * NO_LONG
@@ -100,6 +127,9 @@ CLPDEF int cprintf_impl_(const cchar* fmt, ...);
 #ifdef USE_WIDE_ARGV
 #   define cstrlen    wcslen
 #   define cstrcmp    wcscmp
+#   define cstrncmp   wcsncmp
+#   define cstrchr    wcschr
+#   define cmemchr    wmemchr
 #   define cstrtoull  wcstoull
 #   define iscdigit   iswdigit
 #   define CSTR2(val) L##val
@@ -110,6 +140,9 @@ CLPDEF int cprintf_impl_(const cchar* fmt, ...);
 #else
 #   define cstrlen    strlen
 #   define cstrcmp    strcmp
+#   define cstrncmp   strncmp
+#   define cstrchr    strchr
+#   define cmemchr    memchr
 #   define cstrtoull  strtoull
 #   define iscdigit   isdigit
 #   define CSTR2(val) val
@@ -139,24 +172,317 @@ typedef struct {
 	size_t len;
 } ArrayList;
 
+// An interval `lo-hi:step` of a RangeList. `hi` is always the last member of
+// the interval, i.e. `(hi - lo) % step == 0`.
+typedef struct {
+    uint64_t lo;
+    uint64_t hi;
+    uint64_t step;
+} RangeInterval;
+
+// A sorted set of disjoint intervals. `ends[i]` holds the number of elements in
+// the first `i + 1` intervals, so the cardinality is `ends[len - 1]`. It
+// saturates at UINT64_MAX, which only the whole `0-18446744073709551615` reaches.
+typedef struct {
+    RangeInterval* items;
+    uint64_t* ends;
+    size_t len;
+} RangeList;
+
+// Strings of the argv given to clparseParse
+typedef struct {
+    cchar** items;
+    size_t len;
+} ArgvSlice;
+
 // Function Signatures
 CLPDEF void clparseInit(const cchar* name, const cchar* desc);
+// Every call starts over from the defaults, so nothing of a previous argv is kept
 CLPDEF bool clparseParse(int argc, cchar** argv);
+// Frees everything and forgets every registered flag, argument, subcommand and
+// constraint, so that clparseInit starts over. Handles are invalid afterwards.
 CLPDEF void clparseDeinit(void);
 CLPDEF const char* clparseGetErr(void);
 CLPDEF bool clparseIsHelp(void);
+// When the builder of the selected lazy subcommand fails, only that is printed,
+// and clparseGetErr tells why
 CLPDEF void clparsePrintHelp(void);
 CLPDEF bool* clparseSubcmd(const cchar* subcmd_name, const cchar* desc);
+// Registers a subcommand whose flags and arguments are registered by builder
+// (with subcmd_name as their subcmd) only when it is needed: when argv selects
+// it, when its help is printed, or for completion and serialization. Handles
+// made by builder are valid from then on, so keep them in ctx.
+typedef void (*ClparseSubcmdBuilder)(const cchar* subcmd_name, void* ctx);
+CLPDEF bool* clparseSubcmdLazy(
+    const cchar* subcmd_name,
+    const cchar* desc,
+    ClparseSubcmdBuilder builder,
+    void* ctx);
 CLPDEF const cchar** clparseMainArg(const cchar* name, const cchar* desc, const cchar* subcmd);
+// Collects every positional argument after the ones of clparseMainArg into an
+// array owned by clparse. argv itself is left as it is.
+CLPDEF const ArgvSlice* clparseMainArgs(const cchar* name, const cchar* desc, const cchar* subcmd);
+// Arguments after `--`, which are not parsed at all. It is the tail of argv.
+CLPDEF const ArgvSlice* clparsePassthrough(void);
+
+// A range flag takes `a`, `a-b` and `a-b:step` segments separated by commas
+// (e.g. `--cpus 0-63:2,128-191`) and keeps them as merged intervals. Segments
+// may overlap in any way, but a union which needs more than RANGE_SPLIT_CAPACITY
+// disjoint runs (only huge interleaved strides do) is rejected.
+CLPDEF const RangeList* clparseRange(
+    const cchar* flag_name,
+    cchar short_name,
+    const cchar* desc,
+    const cchar* subcmd);
+
+// RangeList queries. All of them are O(log n) in the number of intervals
+CLPDEF bool clparseRangeContains(const RangeList* rng, uint64_t value);
+CLPDEF uint64_t clparseRangeCount(const RangeList* rng);
+CLPDEF bool clparseRangeNth(const RangeList* rng, uint64_t nth, uint64_t* output);
+CLPDEF bool clparseRangeLowerBound(const RangeList* rng, uint64_t value, uint64_t* output);
+
+// A choice flag accepts only one of choices, and stores its index. Choices are
+// looked up with a perfect hash built at registration, so they must be distinct
+// and outlive the parsing. NULL is returned for no choices, duplicated ones or a
+// default out of them.
+CLPDEF const size_t* clparseChoice(
+    const cchar* flag_name,
+    cchar short_name,
+    size_t dfault,
+    const cchar* const* choices,
+    size_t choices_len,
+    const cchar* desc,
+    const cchar* subcmd);
+
+// Constraints between flags of one scope (the main command or a subcommand),
+// given by the handles returned at registration. They are compiled into bitmasks
+// over flag indices, so clparseParse checks all of them with a few word-wide
+// operations per given flag. Only the scope which is parsed is checked, not
+// while --help is given, and clparseNext does not check them. The handle of any
+// kind of flag is accepted, but not the one of a main argument or a subcommand.
+CLPDEF bool clparseRequired(const void* flag);
+// At most one of flags can be given
+CLPDEF bool clparseExclusive(const void* const* flags, size_t flags_len);
+// flag can be given only with dependency
+CLPDEF bool clparseRequires(const void* flag, const void* dependency);
+
+// Pull style parser
+//
+// Unlike clparseParse, clparseNext resolves one token at a time and stores
+// nothing into flags. It uses the registered flags only to know how many values
+// each flag takes.
+typedef enum {
+    CLPARSE_EVENT_END = 0,
+    CLPARSE_EVENT_FLAG,
+    CLPARSE_EVENT_POSITIONAL,
+    CLPARSE_EVENT_SUBCMD,
+    CLPARSE_EVENT_PASSTHROUGH,
+    CLPARSE_EVENT_ERROR,
+} ClparseEventKind;
+
+typedef struct {
+    ClparseEventKind kind;
+    // the pointer returned when the flag or the subcommand was registered
+    const void* handle;
+    // the long name of the flag, or the name of the subcommand
+    const cchar* name;
+    // a raw value of the flag or the positional argument. Items of comma
+    // separated lists are not null terminated, so use value_len.
+    const cchar* value;
+    size_t value_len;
+} ClparseEvent;
+
+typedef struct {
+    int argc;
+    cchar** argv;
+    int arg;
+    size_t subcmd;         // index of the subcommand, or SIZE_MAX for the main
+    const void* list_flag; // a list flag whose values are being yielded
+    bool is_numeric_list;
+    bool is_inline_list;   // values of list_flag came after `=`, so no token follows
+    const cchar* pending;  // rest of a comma separated value
+    bool is_passthrough;   // whether `--` was seen
+} ClparseIter;
+
+CLPDEF void clparseIterInit(ClparseIter* iter, int argc, cchar** argv);
+// Returns false at the end of argv or on an error. Check event->kind to tell them.
+CLPDEF bool clparseNext(ClparseIter* iter, ClparseEvent* event);
+
+// Snapshots (only with CLPARSE_SNAPSHOT)
+//
+// A snapshot is an immutable copy of every parsed value, strings and list items
+// included. clparsePublish swaps it in atomically, so worker threads can keep
+// reading while the main thread parses again (e.g. on SIGHUP) with
+// clparseReparse. Readers are lock-free: each thread registers a reader once,
+// and brackets its accesses with clparseReadLock and clparseReadUnlock. An old
+// snapshot is freed once no reader that may see it is inside a read section.
+// Publishing must be done from one thread at a time.
+#ifdef CLPARSE_SNAPSHOT
+typedef struct ClparseSnapshot ClparseSnapshot;
+
+typedef struct {
+    uint64_t epoch; // 0 while the reader is out of a read section
+    uint32_t is_used;
+} ClparseReader;
+
+CLPDEF bool clparsePublish(void);
+CLPDEF bool clparseReparse(int argc, cchar** argv);
+CLPDEF ClparseReader* clparseReaderRegister(void);
+CLPDEF void clparseReaderUnregister(ClparseReader* reader);
+CLPDEF const ClparseSnapshot* clparseReadLock(ClparseReader* reader);
+CLPDEF void clparseReadUnlock(ClparseReader* reader);
+// Returns the value of the flag, main argument or subcommand in the snapshot.
+// handle is the pointer returned at registration, and the result has its type.
+// It reads nothing but the snapshot, so it is NULL for a handle registered after
+// the snapshot was published (e.g. by a lazy subcommand).
+CLPDEF const void* clparseSnapshotGet(const ClparseSnapshot* snapshot, const void* handle);
+#endif // CLPARSE_SNAPSHOT
+
+// Serialized parse results
+//
+// clparseSerialize packs every parsed value (scalars, list items, strings and
+// main arguments) into one malloc'd block which stores offsets instead of
+// pointers, so it can be put into shared memory or a memfd. A forked or spawned
+// worker which registered the same flags calls clparseAttach instead of
+// clparseParse, and then reads values with its usual handles. Strings and list
+// items are read from the block in place; only the pointer arrays of string
+// lists and argv slices are rebuilt. The block is never written, so it may be
+// mapped read-only, but it must outlive clparseDeinit. It is only meaningful to
+// the same build of the program. Offsets, string terminators and range
+// intervals are all checked before anything is attached, and a later
+// clparseParse starts over from the defaults without touching the block.
+CLPDEF void* clparseSerialize(size_t* size);
+CLPDEF bool clparseAttach(const void* block, size_t size);
+
+// Limits for parsing untrusted command lines. A zero field means no limit.
+// Items and occurrences count every list and range flag separately, and bytes
+// count what clparseParse allocates for values and its token table.
+typedef struct {
+    size_t max_tokens; // argc
+    size_t max_list_items; // items of one list flag, or intervals of one range flag
+    size_t max_list_occurrences; // occurrences of one list or range flag
+    size_t max_alloc_bytes; // total bytes of one clparseParse
+} ClparseLimits;
+
+// Limits apply to the following clparseParse calls. NULL removes them.
+CLPDEF void clparseSetLimits(const ClparseLimits* limits);
+
+// Path flags (only with CLPARSE_PREFETCH)
+//
+// As soon as a path flag is parsed (or at the end of the parse for a default),
+// a background thread opens the file, stats it and asks the kernel to read it
+// ahead with posix_fadvise(WILLNEED), so the I/O overlaps with the rest of
+// parsing and initialization. Call clparsePathWait before reading the fields.
+// With checks, clparseParse waits for the path itself and fails when the check
+// does not pass. The fd is closed by clparseDeinit unless clparsePathTakeFd
+// takes it. CLPARSE_PATH_WRITABLE alone accepts a write-only file, or a missing
+// one in a writable directory, with fd -1. The handle works with constraints,
+// clparseFingerprintExclude and clparseSnapshotGet, whose copy has fd -1.
+#if defined(CLPARSE_PREFETCH) && (defined(_WIN32) || defined(USE_WIDE_ARGV))
+#   undef CLPARSE_PREFETCH
+#endif
+
+#ifdef CLPARSE_PREFETCH
+#include <sys/stat.h>
+
+typedef enum {
+    CLPARSE_PATH_ANY = 0,
+    CLPARSE_PATH_EXISTS = 1 << 0,
+    CLPARSE_PATH_READABLE = 1 << 1,
+    CLPARSE_PATH_WRITABLE = 1 << 2,
+} ClparsePathCheck;
+
+typedef struct {
+    const cchar* path; // NULL when neither given nor defaulted
+    int fd; // opened read-only, or -1
+    int err; // errno of open, fstat or a check, 0 on success
+    struct stat st; // valid when err is 0, and zeroed for a missing writable path
+} ClparsePath;
+
+CLPDEF const ClparsePath* clparsePath(
+    const cchar* flag_name,
+    cchar short_name,
+    const cchar* dfault,
+    int checks, // ClparsePathCheck bits
+    const cchar* desc,
+    const cchar* subcmd);
+CLPDEF const ClparsePath* clparsePathWait(const ClparsePath* path);
+// Returns the fd and leaves it to the caller, or -1
+CLPDEF int clparsePathTakeFd(const ClparsePath* path);
+#endif // CLPARSE_PREFETCH
+
+// Tracing (only with CLPARSE_TRACE)
+//
+// Probes are parse__begin(argc), parse__end(is_ok), subcmd(name),
+// flag(name, index), list__alloc(name, bytes), help__begin() and help__end().
+// They are SDT probes, so `perf` or `bpftrace` can attach to them, and
+// clparseTraceTo also writes them to fd as Chrome trace events (a JSON array
+// which is left open, as chrome://tracing and Perfetto accept). The opening `[`
+// is written once per sink, so not to a regular file which has data already,
+// nor again to the fd it was last written to. A negative fd stops recording.
+#ifdef CLPARSE_TRACE
+CLPDEF void clparseTraceTo(int fd);
+#endif // CLPARSE_TRACE
+
+// Fingerprint
+//
+// A 128 bits hash of the resolved values for cache keys: the activated
+// subcommand, every flag (defaults included) in registration order, main
+// arguments and passthrough arguments. So `-a -b` and `-b -a`, or passing a
+// default explicitly, give the same fingerprint. It is computed when
+// clparseParse or clparseAttach succeeds, and is stable across runs of the same
+// build. Flags excluded with clparseFingerprintExclude (e.g. `--jobs`) do not
+// contribute to it, so exclude them before parsing.
+CLPDEF void clparseFingerprint(uint64_t output[2]);
+CLPDEF bool clparseFingerprintExclude(const void* handle);
+
+// Transcodes UTF-16 argvs into UTF-8 with one allocation. Both the pointer array
+// and every string live in the returned block, so free it with clparseFreeArgvUtf8.
+// Unpaired surrogates are kept as 3 bytes sequences (WTF-8) so that paths
+// round-trip.
+CLPDEF char** clparseArgvToUtf8(int argc, const uint16_t* const* wargv);
+CLPDEF void clparseFreeArgvUtf8(char** argv);
+
+// Shell completion (not available with wide argvs)
+//
+// Shell scripts generated by clparsePrintCompletionScript run `PROG __complete
+// WORDS...`, and clparseComplete answers it. Call clparseComplete at the very
+// beginning of main with a table dumped by clparseDumpCompletionTable, then the
+// completion is answered before any flags are registered. With a NULL table, it
+// is built from the registered flags instead, running only the builder of the
+// lazy subcommand being completed.
+#ifndef USE_WIDE_ARGV
+typedef struct {
+    const char* scope; // a subcommand name, or "" for the main command
+    const char* word;
+    bool has_value; // a flag which takes the next word as its value
+} CompletionEntry;
+
+typedef struct {
+    const CompletionEntry* entries; // sorted by scope and then word
+    size_t len;
+} CompletionTable;
+
+CLPDEF bool clparseComplete(int argc, char** argv, const CompletionTable* table);
+// shell is "bash", "zsh" or "fish". The program name is written into the script
+// as it is, so it fails for a name with anything but `A-Za-z0-9._+-` in it, or
+// one which starts with `-`.
+CLPDEF bool clparsePrintCompletionScript(const char* shell, FILE* out);
+CLPDEF bool clparseDumpCompletionTable(const char* ident, FILE* out);
+#endif // USE_WIDE_ARGV
 
 // windows specific feature
-#if defined(_WIN32) && !defined(NO_USE_WIDE_ARGV)
+#if defined(_WIN32) && !defined(NO_USE_WIDE_ARGV) && !defined(USE_UTF8_ARGV)
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 CLPDEF bool clparseGetCmdlineW(int* argc, LPWSTR** argv);
 CLPDEF void clparseFreeCmdlineW(const LPWSTR* argv);
 #endif
 
+#if defined(_WIN32) && defined(USE_UTF8_ARGV)
+CLPDEF bool clparseGetCmdlineUtf8(int* argc, char*** argv);
+#endif
+
 #define CLPARSE_TYPES(T)                                                       \
 	T(Bool, bool,       boolean, FLAG_TYPE_BOOL,   ARRAY_LIST_BOOL)            \
 	T(I8,   int8_t,     i8,      FLAG_TYPE_I8,     ARRAY_LIST_I8)              \
@@ -203,6 +529,7 @@ CLPDEF void clparseFreeCmdlineW(const LPWSTR* argv);
 #   include <cctype>
 #   include <cerrno>
 #   include <climits>
+#   include <cstdarg>
 #   include <cstdlib>
 #   include <cstring>
 #else
@@ -210,15 +537,59 @@ CLPDEF void clparseFreeCmdlineW(const LPWSTR* argv);
 #   include <ctype.h>
 #   include <errno.h>
 #   include <limits.h>
+#   include <stdarg.h>
 #   include <stdlib.h>
 #   include <string.h>
 #endif // __cplusplus
 
+#ifdef USE_WIDE_ARGV
+#   ifdef __cplusplus
+#       include <cwchar>
+#       include <cwctype>
+#   else
+#       include <wchar.h>
+#       include <wctype.h>
+#   endif // __cplusplus
+#endif // USE_WIDE_ARGV
+
 #ifdef _WIN32
 #   define WIN32_LEAN_AND_MEAN
 #   include <windows.h>
 #endif
 
+#if defined(CLPARSE_TRACE) && !defined(_WIN32)
+#   include <sys/stat.h>
+#   include <time.h>
+#   include <unistd.h>
+#   if defined(__has_include)
+#       if __has_include(<sys/sdt.h>)
+#           include <sys/sdt.h>
+#           define CLPARSE_HAS_SDT
+#       endif
+#   endif // __has_include
+#else
+#   undef CLPARSE_TRACE
+#endif // CLPARSE_TRACE
+
+#ifdef CLPARSE_PREFETCH
+#   include <fcntl.h>
+#   include <pthread.h>
+#   include <unistd.h>
+#endif // CLPARSE_PREFETCH
+
+#if defined(CLPARSE_PARALLEL) && !defined(_WIN32)
+#   include <pthread.h>
+#   include <unistd.h>
+#   ifndef CLPARSE_PARALLEL_THRESHOLD
+#       define CLPARSE_PARALLEL_THRESHOLD 65536
+#   endif // CLPARSE_PARALLEL_THRESHOLD
+#   ifndef CLPARSE_PARALLEL_THREADS
+#       define CLPARSE_PARALLEL_THREADS 8
+#   endif // CLPARSE_PARALLEL_THREADS
+#else
+#   undef CLPARSE_PARALLEL
+#endif // CLPARSE_PARALLEL
+
 // A Flag and a Subcmd struct definitions
 typedef enum {
     FLAG_TYPE_NIL = 0,
@@ -233,8 +604,42 @@ typedef enum {
     FLAG_TYPE_U64,
     FLAG_TYPE_STRING,
     FLAG_TYPE_LIST,
+    FLAG_TYPE_RANGE,
+    FLAG_TYPE_CHOICE,
+    FLAG_TYPE_PATH,
 } FlagType;
 
+// A perfect hash table of choices. A choice hashes into a bucket, and the
+// displacement of the bucket picks its slot. `slots` holds `index + 1` of each
+// choice, and 0 for an empty slot.
+typedef struct {
+    const cchar* const* choices;
+    size_t len;
+    uint32_t seed;
+    uint32_t mask;
+    uint32_t bucket_mask;
+    uint32_t* displacements;
+    uint16_t* slots;
+} ChoiceTable;
+
+typedef struct {
+    size_t index;
+    ChoiceTable* table;
+} Choice;
+
+// A path flag and its background job. `path` comes first, so that the handle
+// is the job itself.
+#ifdef CLPARSE_PREFETCH
+typedef struct {
+    ClparsePath path;
+    const cchar* dfault;
+    int checks;
+    bool is_running; // a thread is started and not joined yet
+    pthread_t thread;
+    struct Flag* flag; // whose kind.path is this job
+} PathJob;
+#endif // CLPARSE_PREFETCH
+
 typedef union {
     bool boolean;
     int8_t i8;
@@ -247,21 +652,48 @@ typedef union {
     uint64_t u64;
     const cchar* str;
     ArrayList lst;
+    RangeList rng;
+    Choice choice;
+#ifdef CLPARSE_PREFETCH
+    PathJob* path;
+#endif // CLPARSE_PREFETCH
 } FlagKind;
 
-typedef struct {
+typedef struct Flag {
     const cchar* name;
     cchar short_name;
     FlagType type;
     FlagKind kind;
     FlagKind dfault;
     const cchar* desc;
+    bool is_uncached; // excluded from the fingerprint
+    size_t occurrences; // of a list or range flag, for ClparseLimits
+    struct FlagConstraint* constraint; // NULL unless it conflicts with or requires some
+    void* copies; // tokens of a string list copied to be split
 } Flag;
 
 #ifndef FLAG_CAPACITY
 #define FLAG_CAPACITY 256
 #endif // FLAG_CAPACITY
 
+// A set of flag indices of one scope
+#define FLAG_MASK_WORDS ((FLAG_CAPACITY + 63) / 64)
+#define FLAG_MASK_SET(_mask, _idx) ((_mask).words[(_idx) / 64] |= (uint64_t)1 << ((_idx) % 64))
+
+typedef struct {
+    uint64_t words[FLAG_MASK_WORDS];
+} FlagMask;
+
+typedef struct FlagConstraint {
+    FlagMask conflicts;
+    FlagMask dependencies;
+} FlagConstraint;
+
+typedef struct {
+    FlagMask required;
+    FlagMask constrained; // flags whose constraint is not NULL
+} ScopeConstraints;
+
 typedef struct {
     const cchar* name;
     const cchar* value;
@@ -272,14 +704,48 @@ typedef struct {
 #define MAIN_ARGS_CAPACITY 16
 #endif // MAIN_ARGS_CAPACITY
 
+// Error kinds
+typedef enum ClparseErrKind
+{
+    CLPARSE_ERR_KIND_OK = 0,
+    CLPARSE_ERR_KIND_SUBCOMMAND_FIND,
+    CLPARSE_ERR_KIND_FLAG_FIND,
+    CLPARSE_ERR_KIND_MAIN_ARGS_NUM_OVERFLOWED,
+    CLPARSE_ERR_KIND_INAVLID_NUMBER,
+    CLPARSE_ERR_KIND_LONG_FLAG_WITH_SHORT_FLAG,
+    CLPARSE_ERR_KIND_INVALID_RANGE,
+    CLPARSE_ERR_KIND_MISSING_VALUE,
+    CLPARSE_ERR_KIND_INVALID_CHOICE,
+    CLPARSE_ERR_KIND_INVALID_CHOICES,
+    CLPARSE_ERR_KIND_INVALID_BLOCK,
+    CLPARSE_ERR_KIND_TOO_MANY_TOKENS,
+    CLPARSE_ERR_KIND_TOO_MANY_LIST_ITEMS,
+    CLPARSE_ERR_KIND_TOO_MANY_LIST_OCCURRENCES,
+    CLPARSE_ERR_KIND_TOO_MANY_ALLOC_BYTES,
+    CLPARSE_ERR_KIND_CAPACITY_EXCEEDED,
+    CLPARSE_ERR_KIND_INVALID_PATH,
+    CLPARSE_ERR_KIND_INVALID_CONSTRAINT,
+    CLPARSE_ERR_KIND_MISSING_REQUIRED_FLAG,
+    CLPARSE_ERR_KIND_CONFLICTING_FLAGS,
+    CLPARSE_ERR_KIND_MISSING_DEPENDENCY,
+    CLPARSE_INTERNAL_ERROR,
+} ClparseErrKind;
+
 typedef struct Subcmd {
     const cchar* name;
     const cchar* desc;
     bool is_activate;
     MainArg main_args[MAIN_ARGS_CAPACITY];
     size_t main_args_len;
+    MainArg variadic; // variadic.name is NULL unless it is registered
+    ArgvSlice variadic_args;
     Flag flags[FLAG_CAPACITY];
     size_t flags_len;
+    ClparseSubcmdBuilder builder; // NULL once it is built
+    void* builder_ctx;
+    ClparseErrKind build_err; // what the builder failed with, kept for every later use
+    const char* build_err_detail;
+    ScopeConstraints constraints;
 } Subcmd;
 
 #ifndef SUBCOMMAND_CAPACITY
@@ -297,27 +763,160 @@ static size_t subcommands_len = 0;
 static MainArg main_main_args[MAIN_ARGS_CAPACITY];
 static size_t main_args_len = 0;
 
+static MainArg main_variadic;
+static ArgvSlice main_variadic_args;
+static ArgvSlice passthrough_args;
+
 static Flag main_flags[FLAG_CAPACITY];
 static size_t main_flags_len = 0;
+#ifdef CLPARSE_PREFETCH
+#ifndef PATH_FLAG_CAPACITY
+#define PATH_FLAG_CAPACITY 64
+#endif // PATH_FLAG_CAPACITY
+
+// Jobs of path flags live here, so that the address of a handle alone tells
+// its flag, as it does for the other handles
+static PathJob path_jobs[PATH_FLAG_CAPACITY];
+static size_t path_jobs_len = 0;
+#endif // CLPARSE_PREFETCH
+static ScopeConstraints main_constraints;
+static FlagMask seen_flags; // given in the current clparseParse
 
 static bool* help_cmd[SUBCOMMAND_CAPACITY + 1];
 static size_t help_cmd_len = 0;
 
-// Error kinds
-typedef enum ClparseErrKind
-{
-    CLPARSE_ERR_KIND_OK = 0,
-    CLPARSE_ERR_KIND_SUBCOMMAND_FIND,
-    CLPARSE_ERR_KIND_FLAG_FIND,
-    CLPARSE_ERR_KIND_MAIN_ARGS_NUM_OVERFLOWED,
-    CLPARSE_ERR_KIND_INAVLID_NUMBER,
-    CLPARSE_ERR_KIND_LONG_FLAG_WITH_SHORT_FLAG,
-    CLPARSE_INTERNAL_ERROR,
-} ClparseErrKind;
+static uint64_t fingerprint[2];
+
+static ClparseLimits limits;
+static size_t alloc_bytes = 0; // allocated by the current clparseParse
+
+// Probes. Each one is an SDT probe, and is also recorded while clparseTraceTo
+// has an fd.
+#ifdef CLPARSE_TRACE
+static int trace_fd = -1;
+static int trace_header_fd = -1; // the last fd which got the opening `[`
+
+#   ifdef CLPARSE_HAS_SDT
+#       define CLPARSE_SDT0(_name) STAP_PROBE(clparse, _name)
+#       define CLPARSE_SDT1(_name, _a) STAP_PROBE1(clparse, _name, _a)
+#       define CLPARSE_SDT2(_name, _a, _b) STAP_PROBE2(clparse, _name, _a, _b)
+#   else
+#       define CLPARSE_SDT0(_name) ((void)0)
+#       define CLPARSE_SDT1(_name, _a) ((void)0)
+#       define CLPARSE_SDT2(_name, _a, _b) ((void)0)
+#   endif // CLPARSE_HAS_SDT
+
+#   define CLPARSE_TRACE_EVENT(_name, _phase, _subject, _value)                \
+        do {                                                                   \
+            if (trace_fd >= 0) traceEvent(_name, _phase, _subject, _value);    \
+        } while (0)
+#   define TRACE_PARSE_BEGIN(_argc)                                            \
+        do {                                                                   \
+            CLPARSE_SDT1(parse__begin, _argc);                                 \
+            CLPARSE_TRACE_EVENT("parse", 'B', NULL, _argc);                    \
+        } while (0)
+#   define TRACE_PARSE_END(_is_ok)                                             \
+        do {                                                                   \
+            CLPARSE_SDT1(parse__end, _is_ok);                                  \
+            CLPARSE_TRACE_EVENT("parse", 'E', NULL, _is_ok);                   \
+        } while (0)
+#   define TRACE_SUBCMD(_name)                                                 \
+        do {                                                                   \
+            CLPARSE_SDT1(subcmd, _name);                                       \
+            CLPARSE_TRACE_EVENT("subcmd", 'i', _name, 0);                      \
+        } while (0)
+#   define TRACE_FLAG(_name, _index)                                           \
+        do {                                                                   \
+            CLPARSE_SDT2(flag, _name, _index);                                 \
+            CLPARSE_TRACE_EVENT("flag", 'i', _name, _index);                   \
+        } while (0)
+#   define TRACE_LIST_ALLOC(_name, _bytes)                                     \
+        do {                                                                   \
+            CLPARSE_SDT2(list__alloc, _name, _bytes);                          \
+            CLPARSE_TRACE_EVENT("list_alloc", 'i', _name, _bytes);             \
+        } while (0)
+#   define TRACE_HELP_BEGIN()                                                  \
+        do {                                                                   \
+            CLPARSE_SDT0(help__begin);                                         \
+            CLPARSE_TRACE_EVENT("help", 'B', NULL, 0);                         \
+        } while (0)
+#   define TRACE_HELP_END()                                                    \
+        do {                                                                   \
+            CLPARSE_SDT0(help__end);                                           \
+            CLPARSE_TRACE_EVENT("help", 'E', NULL, 0);                         \
+        } while (0)
+#else
+#   define TRACE_PARSE_BEGIN(_argc) ((void)0)
+#   define TRACE_PARSE_END(_is_ok) ((void)0)
+#   define TRACE_SUBCMD(_name) ((void)0)
+#   define TRACE_FLAG(_name, _index) ((void)0)
+#   define TRACE_LIST_ALLOC(_name, _bytes) ((void)0)
+#   define TRACE_HELP_BEGIN() ((void)0)
+#   define TRACE_HELP_END() ((void)0)
+#endif // CLPARSE_TRACE
+
+// Tags of argv tokens. clparseParse classifies every token once before the
+// main loop, so that dispatching and finding runs of list values are scans
+// over a byte array instead of repeated character checks on each token.
+typedef enum {
+    TOKEN_POSITIONAL = 0,
+    TOKEN_SHORT, // `-n`, `-n=value` (and a lone `-`)
+    TOKEN_LONG, // `--name` and `--name=value`
+    TOKEN_NEGATIVE, // `-` and a digit: a short flag, or a value of numeric lists
+    TOKEN_DASHDASH, // `--`
+    TOKEN_AT_FILE, // `@file`. Response files are not expanded, so it is a positional.
+} TokenTag;
+
+// token_lens[i] is the length of argv[i]. Both grow to the largest argc seen.
+static uint8_t* token_tags = NULL;
+static size_t* token_lens = NULL;
+static size_t tokens_capacity = 0;
+
+// The block given to clparseAttach and the pointer arrays rebuilt from it.
+// deinitFlag does not free values which live in them.
+static const char* attached_block = NULL;
+static size_t attached_size = 0;
+static cchar** attached_ptrs = NULL;
+static size_t attached_ptrs_len = 0;
+
+#ifdef CLPARSE_SNAPSHOT
+#ifndef CLPARSE_READERS_CAPACITY
+#define CLPARSE_READERS_CAPACITY 128
+#endif // CLPARSE_READERS_CAPACITY
+
+// Scopes are numbered 0 for the main command and `i + 1` for subcommands[i]
+struct ClparseSnapshot {
+    struct ClparseSnapshot* next_retired;
+    uint64_t retired_epoch;
+    // handles are resolved against these, as the live lengths change under
+    // readers when a lazy subcommand is built
+    size_t subcommands_len;
+    size_t flag_offsets[SUBCOMMAND_CAPACITY + 2];
+    size_t arg_offsets[SUBCOMMAND_CAPACITY + 2];
+#ifdef CLPARSE_PREFETCH
+    size_t path_jobs_len;
+    size_t path_slots[PATH_FLAG_CAPACITY]; // indices into kinds
+#endif // CLPARSE_PREFETCH
+    FlagKind* kinds;
+    const cchar** args;
+    bool activated[SUBCOMMAND_CAPACITY];
+    ArgvSlice variadics[SUBCOMMAND_CAPACITY + 1];
+    ArgvSlice passthrough;
+};
+
+static ClparseSnapshot* current_snapshot = NULL;
+static ClparseSnapshot* retired_snapshots = NULL;
+static uint64_t snapshot_epoch = 1;
+static ClparseReader snapshot_readers[CLPARSE_READERS_CAPACITY];
+#endif // CLPARSE_SNAPSHOT
 
 static ClparseErrKind clparse_err = CLPARSE_ERR_KIND_OK;
 static char internal_err_msg[201];
 static const char* err_msg_detail = NULL;
+static const Flag* err_flag = NULL;
+static const Flag* err_other_flag = NULL;
+static const cchar* err_value = NULL;
+static size_t err_index = 0;
 
 // A container of subcommand names (with a hashmap)
 // This hashmap made of fnv1a hash algorithm
@@ -332,16 +931,120 @@ typedef struct HashBox
 
 static HashBox hash_map[CLPARSE_HASHMAP_CAPACITY];
 
+// What a pointer returned at registration points to
+typedef enum {
+    HANDLE_FLAG,
+    HANDLE_MAIN_ARG,
+    HANDLE_SUBCMD,
+    HANDLE_VARIADIC,
+    HANDLE_PASSTHROUGH,
+} HandleKind;
+
+#define CLPARSE_ALIGN_UP(_size) (((_size) + 7) & ~(size_t)7)
+
+// Layout of a serialized block. Every offset is from the start of the block,
+// and 0 (the header itself) stands for NULL. A string array is an array of
+// offsets to NUL terminated strings.
+#define CLPARSE_BLOCK_MAGIC 0x42504c43 // "CLPB"
+#define CLPARSE_BLOCK_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+    uint16_t cchar_size;
+    uint16_t pointer_size;
+    uint32_t scopes_len;
+    uint64_t scopes_offset; // BlockScope[scopes_len]
+    uint64_t passthrough_offset;
+    uint64_t passthrough_len;
+} BlockHeader;
+
+typedef struct {
+    uint32_t flags_len;
+    uint32_t args_len;
+    uint64_t flags_offset; // BlockFlag[flags_len]
+    uint64_t args_offset; // offsets of main argument values
+    uint64_t variadic_offset;
+    uint64_t variadic_len;
+    uint32_t is_activate;
+} BlockScope;
+
+typedef struct {
+    uint32_t type;
+    uint32_t list_kind;
+    uint64_t scalar; // bytes of a scalar value or a choice index
+    uint64_t offset; // a string, list items, or range items followed by ends
+    uint64_t len;
+} BlockFlag;
+
 /******************************/
 /* Static Function Signatures */
 /******************************/
-static bool isTruthy(const cchar* string);
+static bool isTruthy(const cchar* string, size_t len);
+static bool isSplitList(const Flag* flag);
+static cchar* copyListToken(Flag* flag, const cchar* token);
+static void freeListCopies(Flag* flag);
+static size_t transcodeUtf16(char* output, const uint16_t* str);
+#ifndef USE_WIDE_ARGV
+static bool buildCompletionTable(CompletionTable* table);
+static int compareCompletionKey(const CompletionEntry* entry, const char* scope, const char* word);
+static size_t lowerBoundCompletion(const CompletionTable* table, const char* scope, const char* word);
+static int compareCompletionEntry(const void* lhs, const void* rhs);
+static void dumpStringLiteral(const char* str, FILE* out);
+#endif // USE_WIDE_ARGV
 static void deinitFlag(Flag* flag);
 static size_t clparseHash(const cchar* letter);
 static MainArg* clparseGetMainArg(const cchar* subcmd);
 static Flag* clparseGetFlag(const cchar* subcmd);
 static bool findSubcmdPosition(size_t* output, const cchar* subcmd_name);
+static bool buildSubcmd(Subcmd* subcmd);
+static bool buildAllSubcmds(void);
+static FlagConstraint* getFlagConstraint(const void* handle, size_t* scope, size_t* idx);
+static bool checkConstraints(const Flag* flags, const ScopeConstraints* constraints);
+static size_t lowestBit(uint64_t word);
 static void freeNextHashBox(HashBox* hashbox);
+static Flag* findFlag(Flag* flags, size_t flags_len, cchar* token, size_t token_len,
+                      cchar** inline_value);
+static bool parseInteger(const cchar* str, cchar** end, uint64_t* output);
+static size_t countListItems(const cchar* value, size_t len);
+static bool classifyTokens(int argc, cchar** argv);
+static TokenTag classifyToken(const cchar* token);
+static bool isPositionalTag(uint8_t tag);
+static bool isListTag(uint8_t tag, bool is_numeric);
+static bool reserveAllocBytes(size_t count, size_t size);
+static bool parseArgv(int argc, cchar** argv);
+#ifdef CLPARSE_PREFETCH
+static void startPathJob(PathJob* job, const cchar* path);
+static void joinPathJob(PathJob* job);
+static bool finishPathJobs(Flag* flags, size_t flags_len);
+#endif // CLPARSE_PREFETCH
+#ifdef CLPARSE_TRACE
+static void traceEvent(const char* name, char phase, const cchar* subject, long long value);
+#endif // CLPARSE_TRACE
+static bool checkListLimits(Flag* flag, size_t len, size_t count, size_t item_size);
+#ifdef CLPARSE_PARALLEL
+static bool convertListParallel(Flag* flag, cchar** tokens, size_t offset, size_t len);
+#endif // CLPARSE_PARALLEL
+static bool appendRanges(RangeList* rng, const cchar* str);
+static ChoiceTable* buildChoiceTable(const cchar* const* choices, size_t len);
+static bool resolveHandle(const void* handle, HandleKind* kind, size_t* scope, size_t* idx);
+static void computeFingerprint(void);
+static void resetFlag(Flag* flag);
+static void resetValues(void);
+#ifdef CLPARSE_SNAPSHOT
+static ClparseSnapshot* buildSnapshot(void);
+static void reclaimSnapshots(bool is_all);
+#endif // CLPARSE_SNAPSHOT
+static uint64_t hashChoice(const cchar* str, uint32_t seed);
+static uint32_t choiceSlot(uint64_t hash, uint32_t disp, uint32_t mask);
+static uint16_t findChoice(const ChoiceTable* table, const cchar* value);
+static bool normalizeRanges(RangeList* rng, size_t len);
+static int compareRangeInterval(const void* lhs, const void* rhs);
+static size_t writeBlock(char* block);
+static bool attachBlock(const char* block, size_t size, cchar** ptrs, size_t* ptrs_len);
+static bool isAttached(const void* ptr);
+static void freeArgvSlice(ArgvSlice* slice);
 
 /************************************/
 /* Implementation of Main Functions */
@@ -363,15 +1066,53 @@ void clparseDeinit(void) {
 
     for (size_t i = 0; i < main_flags_len; ++i) {
         deinitFlag(&main_flags[i]);
+        free(main_flags[i].constraint);
+        main_flags[i].constraint = NULL;
     }
+    freeArgvSlice(&main_variadic_args);
 
     Subcmd* subcmd;
     for (size_t i = 0; i < subcommands_len; ++i) {
         subcmd = &subcommands[i];
         for (size_t j = 0; j < subcmd->flags_len; ++j) {
             deinitFlag(&subcmd->flags[j]);
+            free(subcmd->flags[j].constraint);
+            subcmd->flags[j].constraint = NULL;
         }
+        freeArgvSlice(&subcmd->variadic_args);
     }
+
+#ifdef CLPARSE_SNAPSHOT
+    reclaimSnapshots(true);
+#endif // CLPARSE_SNAPSHOT
+
+    free(token_tags);
+    free(token_lens);
+    token_tags = NULL;
+    token_lens = NULL;
+    tokens_capacity = 0;
+
+    free(attached_ptrs);
+    attached_ptrs = NULL;
+    attached_ptrs_len = 0;
+    attached_block = NULL;
+    attached_size = 0;
+
+    // so that clparseInit can start over (e.g. for the next clparse::Parser)
+    memset(main_flags, 0, sizeof(Flag) * main_flags_len);
+    main_flags_len = 0;
+#ifdef CLPARSE_PREFETCH
+    path_jobs_len = 0;
+#endif // CLPARSE_PREFETCH
+    subcommands_len = 0;
+    main_args_len = 0;
+    help_cmd_len = 0;
+    activated_subcmd = NULL;
+    memset(&main_variadic, 0, sizeof(MainArg));
+    memset(&main_variadic_args, 0, sizeof(ArgvSlice));
+    memset(&passthrough_args, 0, sizeof(ArgvSlice));
+    memset(&main_constraints, 0, sizeof(ScopeConstraints));
+    clparse_err = CLPARSE_ERR_KIND_OK;
 }
 
 bool clparseIsHelp(void) {
@@ -387,11 +1128,23 @@ bool clparseIsHelp(void) {
 void clparsePrintHelp(void) {
     size_t tmp, name_len = 0;
 
+    TRACE_HELP_BEGIN();
+
     if (!main_prog_name) main_prog_name = CSTR("(*.*)");
+
+    // the main help would be a wrong answer, so only the failure is told
+    if (activated_subcmd && !buildSubcmd(activated_subcmd)) {
+        cprintf(CSTR("Cannot print the help of `%" CSTR_FMT " %" CSTR_FMT "`, "
+                     "as its flags failed to register\n"),
+            main_prog_name, activated_subcmd->name);
+        TRACE_HELP_END();
+        return;
+    }
+
     if (main_prog_desc) cprintf(CSTR("%s\n\n"), main_prog_desc);
 
     if (activated_subcmd) {
-        cprintf(CSTR("Usage: %"CSTR_FMT" %"CSTR_FMT" [ARGS] [FLAGS]\n\n"),
+        cprintf(CSTR("Usage: %" CSTR_FMT " %" CSTR_FMT " [ARGS] [FLAGS]\n\n"),
             main_prog_name, activated_subcmd->name);
 
         cprintf(CSTR("Args:\n"));
@@ -400,10 +1153,14 @@ void clparsePrintHelp(void) {
             name_len = name_len > tmp ? name_len : tmp;
         }
         for (size_t i = 0; i < activated_subcmd->main_args_len; ++i) {
-            cprintf(CSTR("     %*"CSTR_FMT"%"CSTR_FMT"\n"), -(int)name_len - 4,
+            cprintf(CSTR("     %*" CSTR_FMT "%" CSTR_FMT "\n"), -(int)name_len - 4,
                 activated_subcmd->main_args[i].name,
                 activated_subcmd->main_args[i].desc);
         }
+        if (activated_subcmd->variadic.name) {
+            cprintf(CSTR("     %" CSTR_FMT "...    %" CSTR_FMT "\n"),
+                activated_subcmd->variadic.name, activated_subcmd->variadic.desc);
+        }
 
         cprintf(CSTR("Options:\n"));
         for (size_t i = 0; i < activated_subcmd->flags_len; ++i) {
@@ -412,15 +1169,15 @@ void clparsePrintHelp(void) {
         }
         for (size_t i = 0; i < activated_subcmd->flags_len; ++i) {
             if (cstrcmp(activated_subcmd->flags[i].name, NO_LONG) != 0) {
-                cprintf(CSTR("    --%*"CSTR_FMT"%"CSTR_FMT"\n"), -(int)name_len - 4,
+                cprintf(CSTR("    --%*" CSTR_FMT "%" CSTR_FMT "\n"), -(int)name_len - 4,
                     activated_subcmd->flags[i].name,
                     activated_subcmd->flags[i].desc);
             } else if (activated_subcmd->flags[i].short_name == NO_SHORT) {
-                cprintf(CSTR("    -%*"CCHAR_FMT"%"CSTR_FMT"\n"), -(int)name_len - 4,
+                cprintf(CSTR("    -%*" CCHAR_FMT "%" CSTR_FMT "\n"), -(int)name_len - 4,
                     activated_subcmd->flags[i].short_name,
                     activated_subcmd->flags[i].desc);
             } else {
-                cprintf(CSTR("    -%*"CCHAR_FMT" --%*"CSTR_FMT"%"CSTR_FMT"\n"),
+                cprintf(CSTR("    -%*" CCHAR_FMT " --%*" CSTR_FMT "%" CSTR_FMT "\n"),
                     -(int)name_len - 4,
                     activated_subcmd->flags[i].short_name,
                     activated_subcmd->flags[i].name,
@@ -429,10 +1186,10 @@ void clparsePrintHelp(void) {
         }
     } else {
         if (subcommands_len > 0) {
-            cprintf(CSTR("Usage: %"CSTR_FMT" [SUBCOMMANDS] [ARGS] [FLAGS]\n\n"),
+            cprintf(CSTR("Usage: %" CSTR_FMT " [SUBCOMMANDS] [ARGS] [FLAGS]\n\n"),
                 main_prog_name);
         } else {
-            cprintf(CSTR("Usage: %"CSTR_FMT" [ARGS] [FLAGS]\n\n"),
+            cprintf(CSTR("Usage: %" CSTR_FMT " [ARGS] [FLAGS]\n\n"),
                 main_prog_name);
         }
 
@@ -442,9 +1199,13 @@ void clparsePrintHelp(void) {
             name_len = name_len > tmp ? name_len : tmp;
         }
         for (size_t i = 0; i < main_args_len; ++i) {
-            cprintf(CSTR("    %*"CSTR_FMT"%"CSTR_FMT"\n"), -(int)name_len - 4,
+            cprintf(CSTR("    %*" CSTR_FMT "%" CSTR_FMT "\n"), -(int)name_len - 4,
                 main_main_args[i].name, main_main_args[i].desc);
         }
+        if (main_variadic.name) {
+            cprintf(CSTR("    %" CSTR_FMT "...    %" CSTR_FMT "\n"),
+                main_variadic.name, main_variadic.desc);
+        }
 
         cprintf(CSTR("Options:\n"));
         for (size_t i = 0; i < main_flags_len; ++i) {
@@ -453,13 +1214,13 @@ void clparsePrintHelp(void) {
         }
         for (size_t i = 0; i < main_flags_len; ++i) {
             if (cstrcmp(main_flags[i].name, NO_LONG) != 0) {
-                cprintf(CSTR("    --%*"CSTR_FMT"%"CSTR_FMT"\n"), -(int)name_len - 4,
+                cprintf(CSTR("    --%*" CSTR_FMT "%" CSTR_FMT "\n"), -(int)name_len - 4,
                     main_flags[i].name, main_flags[i].desc);
             } else if (main_flags[i].short_name == NO_SHORT) {
-                cprintf(CSTR("    -%*"CCHAR_FMT"%"CSTR_FMT"\n"), -(int)name_len - 4,
+                cprintf(CSTR("    -%*" CCHAR_FMT "%" CSTR_FMT "\n"), -(int)name_len - 4,
                     main_flags[i].short_name, main_flags[i].desc);
             } else {
-                cprintf(CSTR("    -%*"CCHAR_FMT" --%*"CSTR_FMT"%"CSTR_FMT"\n"),
+                cprintf(CSTR("    -%*" CCHAR_FMT " --%*" CSTR_FMT "%" CSTR_FMT "\n"),
                     -(int)name_len - 4,
                     main_flags[i].short_name,
                     main_flags[i].name,
@@ -475,77 +1236,188 @@ void clparsePrintHelp(void) {
                 name_len = name_len > tmp ? name_len : tmp;
             }
             for (size_t i = 0; i < subcommands_len; ++i) {
-                cprintf(CSTR("    %*"CSTR_FMT"%"CSTR_FMT"\n"), -(int)name_len - 4,
+                cprintf(CSTR("    %*" CSTR_FMT "%" CSTR_FMT "\n"), -(int)name_len - 4,
                     subcommands[i].name, subcommands[i].desc);
             }
         }
     }
+
+    TRACE_HELP_END();
 }
 
 // Helper macros to implement clparseParse
 #define IMPL_PARSE_INTEGER(_field, _type)                                      \
     do {                                                                       \
-        flag->kind._field = (_type)cstrtoull(argv[arg++], NULL, 0);            \
-        if (errno == EINVAL || errno == ERANGE) {                              \
+        uint64_t number;                                                       \
+        cchar* end;                                                            \
+        if (!value || !parseInteger(value, &end, &number) || *end) {           \
             clparse_err = CLPARSE_ERR_KIND_INAVLID_NUMBER;                     \
+            err_flag = flag;                                                   \
+            err_value = value;                                                 \
             return false;                                                      \
         }                                                                      \
+        flag->kind._field = (_type)number;                                     \
     } while (0)
 
-#define IMPL_PARSE_INTEGER_LIST(_type)                                         \
+// Every token of the run (or the inline value of `--flag=...`) can hold several
+// items separated by commas. Items are counted first so that the list grows
+// only once per occurrence of the flag.
+#define IMPL_PARSE_LIST(_type, _is_numeric, _convert)                          \
     do {                                                                       \
         size_t prev_lst_len = flag->kind.lst.len;                              \
         size_t lst_len = 0;                                                    \
-        size_t init_arg = arg;                                                 \
+        bool is_split = isSplitList(flag);                                     \
+        int run_end = arg;                                                     \
+        _type* items;                                                          \
+        cchar* token;                                                          \
                                                                                \
-        while (argv[arg + lst_len] != NULL &&                                  \
-                (argv[arg + lst_len][0] != CSTR('-') ||                        \
-                    iscdigit(argv[arg + lst_len][1]))) {                       \
-            ++lst_len;                                                         \
+        if (inline_value) {                                                    \
+            lst_len = is_split                                                 \
+                ? countListItems(inline_value, cstrlen(inline_value)) : 1;     \
+        } else {                                                               \
+            while (run_end < argc && isListTag(token_tags[run_end], _is_numeric)) {\
+                lst_len += is_split                                            \
+                    ? countListItems(argv[run_end], token_lens[run_end]) : 1;  \
+                ++run_end;                                                     \
+            }                                                                  \
         }                                                                      \
-                                                                               \
-        if (flag->kind.lst.len == 0) {                                         \
-            flag->kind.lst.items = malloc(sizeof(_type) * lst_len);            \
-            flag->kind.lst.len = lst_len;                                      \
+        if (lst_len == 0) break;                                               \
+        if (!checkListLimits(flag, prev_lst_len, lst_len, sizeof(_type))) {    \
+            return false;                                                      \
         }                                                                      \
-        else {                                                                 \
-            flag->kind.lst.items =                                             \
-                realloc(flag->kind.lst.items,                                  \
-                        sizeof(_type) * (prev_lst_len + lst_len));             \
-            flag->kind.lst.len += lst_len;                                     \
+                                                                               \
+        items = (_type*)realloc(flag->kind.lst.items,                          \
+                                sizeof(_type) * (prev_lst_len + lst_len));     \
+        if (!items) {                                                          \
+            clparse_err = CLPARSE_INTERNAL_ERROR;                              \
+            err_msg_detail = "clparseParse (list allocation)";                 \
+            return false;                                                      \
         }                                                                      \
+        flag->kind.lst.items = items;                                          \
+        flag->kind.lst.len = prev_lst_len + lst_len;                           \
+        TRACE_LIST_ALLOC(flag->name, sizeof(_type) * lst_len);                 \
                                                                                \
-        for (size_t i = prev_lst_len; i < flag->kind.lst.len; ++i) {           \
-            ((_type*)flag->kind.lst.items)[i] =                                \
-                (_type)cstrtoull(argv[arg++], NULL, 0);                        \
-            if (errno == EINVAL || errno == ERANGE) {                          \
-                clparse_err = CLPARSE_ERR_KIND_INAVLID_NUMBER;                 \
+        IMPL_PARSE_LIST_PARALLEL(_is_numeric)                                  \
+                                                                               \
+        items += prev_lst_len;                                                 \
+        token = inline_value ? inline_value : argv[arg++];                     \
+        while (token) {                                                        \
+            for (;;) {                                                         \
+                cchar* comma = is_split ? cstrchr(token, CSTR(',')) : NULL;    \
+                _convert                                                       \
+                if (!comma) break;                                             \
+                token = comma + 1;                                             \
+            }                                                                  \
+            token = arg < run_end ? argv[arg++] : NULL;                        \
+        }                                                                      \
+    } while (0)
+
+// Large numeric lists are converted in chunks on several threads. The list
+// is already allocated with its exact size, and every chunk writes its own range.
+#ifdef CLPARSE_PARALLEL
+#define IMPL_PARSE_LIST_PARALLEL(_is_numeric)                                  \
+        if (_is_numeric && lst_len >= CLPARSE_PARALLEL_THRESHOLD) {            \
+            bool is_converted = inline_value                                   \
+                ? convertListParallel(flag, &inline_value, prev_lst_len, lst_len) \
+                : convertListParallel(flag, argv + arg, prev_lst_len, lst_len);  \
+            if (!is_converted) return false;                                   \
+            if (!inline_value) arg = run_end;                                  \
+            break;                                                             \
+        }
+#else
+#define IMPL_PARSE_LIST_PARALLEL(_is_numeric)
+#endif // CLPARSE_PARALLEL
+
+#define IMPL_CONVERT_INTEGER(_type)                                            \
+    {                                                                          \
+        uint64_t number;                                                       \
+        cchar* end;                                                            \
+        if (!parseInteger(token, &end, &number) ||                             \
+                (*end != CSTR(',') && *end != CSTR('\0'))) {                   \
+            clparse_err = CLPARSE_ERR_KIND_INAVLID_NUMBER;                     \
+            err_flag = flag;                                                   \
+            err_index = (size_t)(items - (_type*)flag->kind.lst.items);        \
+            free(flag->kind.lst.items);                                        \
+            flag->kind.lst.items = NULL;                                       \
+            flag->kind.lst.len = 0;                                            \
+            return false;                                                      \
+        }                                                                      \
+        *items++ = (_type)number;                                              \
+    }
+
+#define IMPL_CONVERT_BOOL                                                      \
+    {                                                                          \
+        *items++ = isTruthy(token, comma ? (size_t)(comma - token) : cstrlen(token)); \
+    }
+
+// argv is never written, so a string with commas is split in a copy owned by
+// the flag, and every item is still a null terminated string
+#define IMPL_CONVERT_STRING                                                    \
+    {                                                                          \
+        if (comma) {                                                           \
+            cchar* copy = copyListToken(flag, token);                          \
+            if (!copy) {                                                       \
                 free(flag->kind.lst.items);                                    \
+                flag->kind.lst.items = NULL;                                   \
+                flag->kind.lst.len = 0;                                        \
                 return false;                                                  \
             }                                                                  \
+            while ((comma = cstrchr(copy, CSTR(','))) != NULL) {               \
+                *comma = CSTR('\0');                                           \
+                *items++ = copy;                                               \
+                copy = comma + 1;                                              \
+            }                                                                  \
+            token = copy;                                                      \
         }                                                                      \
-        assert((init_arg + lst_len == (size_t)arg) &&                          \
-               "argument parsing failed");                                     \
-    } while (0)
+        *items++ = token;                                                      \
+    }
 
 bool clparseParse(int argc, cchar** argv) {
-    MainArg* main_args;
+    bool is_ok;
+
+    TRACE_PARSE_BEGIN(argc);
+    is_ok = parseArgv(argc, argv);
+    TRACE_PARSE_END(is_ok);
+
+    return is_ok;
+}
+
+static bool parseArgv(int argc, cchar** argv) {
+    MainArg *main_args, *variadic;
+    ArgvSlice* variadic_args;
     Flag *flags, *flag;
+    const ScopeConstraints* constraints;
     size_t total_args_count, total_flags_count;
-    size_t args_count = 0, flags_count = 0;
+    size_t args_count = 0;
     int arg = 1;
 
+    resetValues();
+    memset(&seen_flags, 0, sizeof(FlagMask));
+    alloc_bytes = 0;
+
     if (argc < 2) {
 #ifdef NOT_ALLOW_EMPTY_ARGUMENT
         clparsePrintHelp();
         return false;
 #else
+        if (!checkConstraints(main_flags, &main_constraints)) return false;
+#ifdef CLPARSE_PREFETCH
+        if (!finishPathJobs(main_flags, main_flags_len)) return false;
+#endif // CLPARSE_PREFETCH
+        computeFingerprint();
         return true;
 #endif
     }
 
+    if (limits.max_tokens && (size_t)argc > limits.max_tokens) {
+        clparse_err = CLPARSE_ERR_KIND_TOO_MANY_TOKENS;
+        return false;
+    }
+    if (!reserveAllocBytes((size_t)argc, sizeof(uint8_t) + sizeof(size_t))) return false;
+    if (!classifyTokens(argc, argv)) return false;
+
     // check whether has a subcommand
-    if (subcommands_len > 0 && argv[arg][0] != CSTR('-')) {
+    if (subcommands_len > 0 && isPositionalTag(token_tags[arg])) {
         size_t pos;
         if (!findSubcmdPosition(&pos, argv[arg++])) {
             clparse_err = CLPARSE_ERR_KIND_SUBCOMMAND_FIND;
@@ -553,59 +1425,76 @@ bool clparseParse(int argc, cchar** argv) {
         }
         activated_subcmd = &subcommands[pos];
         activated_subcmd->is_activate = true;
+        TRACE_SUBCMD(activated_subcmd->name);
+        if (!buildSubcmd(activated_subcmd)) return false;
 
         main_args = activated_subcmd->main_args;
-        main_args_len = activated_subcmd->main_args_len;
+        total_args_count = activated_subcmd->main_args_len;
+        variadic = &activated_subcmd->variadic;
+        variadic_args = &activated_subcmd->variadic_args;
         flags = activated_subcmd->flags;
         total_flags_count = activated_subcmd->flags_len;
+        constraints = &activated_subcmd->constraints;
     } else {
         main_args = main_main_args;
         total_args_count = main_args_len;
+        variadic = &main_variadic;
+        variadic_args = &main_variadic_args;
         flags = main_flags;
         total_flags_count = main_flags_len;
+        constraints = &main_constraints;
     }
 
     while (arg < argc) {
-        if (cstrcmp(argv[arg], CSTR("--")) == 0) {
-            ++arg;
-            continue;
+        cchar* inline_value = NULL;
+        const cchar* value;
+
+        if (token_tags[arg] == TOKEN_DASHDASH) {
+            passthrough_args.items = argv + arg + 1;
+            passthrough_args.len = (size_t)(argc - arg - 1);
+            break;
         }
 
-        if (argv[arg][0] != CSTR('-')) {
-            if (args_count >= total_args_count) {
+        if (isPositionalTag(token_tags[arg])) {
+            if (args_count < total_args_count) {
+                main_args[args_count++].value = argv[arg++];
+            } else if (variadic->name) {
+                // no more than the rest of argv can be collected
+                if (!variadic_args->items) {
+                    if (!reserveAllocBytes((size_t)(argc - arg), sizeof(cchar*))) return false;
+                    variadic_args->items = (cchar**)malloc(sizeof(cchar*) * (size_t)(argc - arg));
+                    if (!variadic_args->items) {
+                        clparse_err = CLPARSE_INTERNAL_ERROR;
+                        err_msg_detail = "clparseParse (variadic allocation)";
+                        return false;
+                    }
+                }
+                variadic_args->items[variadic_args->len++] = argv[arg++];
+            } else {
                 clparse_err = CLPARSE_ERR_KIND_MAIN_ARGS_NUM_OVERFLOWED;
                 return false;
             }
-            main_args[args_count++].value = argv[arg++];
             continue;
-        } else {
-            if (argv[arg][1] == CSTR('-')) {
-                if (!flags[flags_count].name) {
-                    clparse_err = CLPARSE_ERR_KIND_FLAG_FIND;
-                    return false;
-                }
-                for (; flags_count < total_flags_count &&
-                    cstrcmp(&argv[arg][2], flags[flags_count].name) != 0; ++flags_count);
-            } else {
-                if (cstrlen(&argv[arg][1]) > 1) {
-                    clparse_err = CLPARSE_ERR_KIND_LONG_FLAG_WITH_SHORT_FLAG;
-                    return false;
-                }
-                for (; flags_count < total_flags_count && argv[arg][1] != flags[flags_count].short_name; ++flags_count);
-            }
         }
 
-        if (flags_count >= total_flags_count) {
-            clparse_err = CLPARSE_ERR_KIND_FLAG_FIND;
-            return false;
-        }
-
-        flag = &flags[flags_count];
+        flag = findFlag(flags, total_flags_count, argv[arg], token_lens[arg], &inline_value);
+        if (!flag) return false;
+        TRACE_FLAG(flag->name, arg);
+        FLAG_MASK_SET(seen_flags, (size_t)(flag - flags));
         ++arg;
 
+        // a value of a flag is either `--flag=value` or the next token
+        if (inline_value) {
+            value = inline_value;
+        } else if (flag->type != FLAG_TYPE_BOOL && flag->type != FLAG_TYPE_LIST) {
+            value = arg < argc ? argv[arg++] : NULL;
+        } else {
+            value = NULL;
+        }
+
         switch (flag->type) {
             case FLAG_TYPE_BOOL:
-                flag->kind.boolean = true;
+                flag->kind.boolean = value ? isTruthy(value, cstrlen(value)) : true;
                 break;
 
             case FLAG_TYPE_I8:
@@ -641,124 +1530,275 @@ bool clparseParse(int argc, cchar** argv) {
                 break;
 
             case FLAG_TYPE_STRING:
-                flag->kind.str = argv[arg++];
+                if (!value) {
+                    clparse_err = CLPARSE_ERR_KIND_MISSING_VALUE;
+                    return false;
+                }
+                flag->kind.str = value;
                 break;
 
             case FLAG_TYPE_LIST:
                 switch (flag->kind.lst.kind) {
-                case ARRAY_LIST_BOOL: {
-                    size_t prev_lst_len = flag->kind.lst.len;
-                    size_t lst_len = 0;
-                    size_t init_arg = arg;
-
-                    while (argv[arg + lst_len] != NULL &&
-                           argv[arg + lst_len][0] != CSTR('-')) {
-                        ++lst_len;
-                    }
-
-                    if (flag->kind.lst.len == 0) {
-                        flag->kind.lst.items = malloc(sizeof(bool) * lst_len);
-                        flag->kind.lst.len = lst_len;
-                    }
-                    else {
-                        flag->kind.lst.items =
-                            realloc(flag->kind.lst.items,
-                                    sizeof(bool) * (prev_lst_len + lst_len));
-                        flag->kind.lst.len += lst_len;
-                    }
-
-                    for (size_t i = prev_lst_len; i < flag->kind.lst.len; ++i) {
-                        ((bool*)flag->kind.lst.items)[i] =
-                            isTruthy(argv[arg++]);
-                    }
-                    assert((init_arg + lst_len == (size_t)arg) &&
-                           "argument parsing failed");
-                }
-                break;
+                case ARRAY_LIST_BOOL:
+                    IMPL_PARSE_LIST(bool, false, IMPL_CONVERT_BOOL);
+                    break;
 
                 case ARRAY_LIST_I8:
-                    IMPL_PARSE_INTEGER_LIST(int8_t);
+                    IMPL_PARSE_LIST(int8_t, true, IMPL_CONVERT_INTEGER(int8_t));
                     break;
 
                 case ARRAY_LIST_I16:
-                    IMPL_PARSE_INTEGER_LIST(int16_t);
+                    IMPL_PARSE_LIST(int16_t, true, IMPL_CONVERT_INTEGER(int16_t));
                     break;
 
                 case ARRAY_LIST_I32:
-                    IMPL_PARSE_INTEGER_LIST(int32_t);
+                    IMPL_PARSE_LIST(int32_t, true, IMPL_CONVERT_INTEGER(int32_t));
                     break;
 
                 case ARRAY_LIST_I64:
-                    IMPL_PARSE_INTEGER_LIST(int64_t);
+                    IMPL_PARSE_LIST(int64_t, true, IMPL_CONVERT_INTEGER(int64_t));
                     break;
 
                 case ARRAY_LIST_U8:
-                    IMPL_PARSE_INTEGER_LIST(uint8_t);
+                    IMPL_PARSE_LIST(uint8_t, true, IMPL_CONVERT_INTEGER(uint8_t));
                     break;
 
                 case ARRAY_LIST_U16:
-                    IMPL_PARSE_INTEGER_LIST(uint16_t);
+                    IMPL_PARSE_LIST(uint16_t, true, IMPL_CONVERT_INTEGER(uint16_t));
                     break;
 
                 case ARRAY_LIST_U32:
-                    IMPL_PARSE_INTEGER_LIST(uint32_t);
+                    IMPL_PARSE_LIST(uint32_t, true, IMPL_CONVERT_INTEGER(uint32_t));
                     break;
 
                 case ARRAY_LIST_U64:
-                    IMPL_PARSE_INTEGER_LIST(uint64_t);
+                    IMPL_PARSE_LIST(uint64_t, true, IMPL_CONVERT_INTEGER(uint64_t));
+                    break;
+
+                case ARRAY_LIST_STRING:
+                    IMPL_PARSE_LIST(const cchar*, false, IMPL_CONVERT_STRING);
                     break;
+            }
+            break;
 
-                case ARRAY_LIST_STRING: {
-                    size_t prev_lst_len = flag->kind.lst.len;
-                    size_t lst_len = 0;
-                    size_t init_arg = arg;
+            case FLAG_TYPE_RANGE:
+                if (value && !checkListLimits(flag, flag->kind.rng.len,
+                                              countListItems(value, cstrlen(value)),
+                                              sizeof(RangeInterval) + sizeof(uint64_t))) {
+                    return false;
+                }
+                if (!value || !appendRanges(&flag->kind.rng, value)) {
+                    clparse_err = CLPARSE_ERR_KIND_INVALID_RANGE;
+                    return false;
+                }
+                break;
 
-                    while (argv[arg + lst_len] != NULL &&
-                           argv[arg + lst_len][0] != CSTR('-')) {
-                        ++lst_len;
-                    }
+            case FLAG_TYPE_CHOICE: {
+                const ChoiceTable* table = flag->kind.choice.table;
+                uint16_t slot;
 
-                    if (flag->kind.lst.len == 0) {
-                        flag->kind.lst.items =
-                            malloc(sizeof(const cchar*) * lst_len);
-                        flag->kind.lst.len = lst_len;
-                    }
-                    else {
-                        flag->kind.lst.items = realloc(
-                            flag->kind.lst.items,
-                            sizeof(const cchar*) * (prev_lst_len + lst_len));
-                        flag->kind.lst.len += lst_len;
-                    }
+                if (!value) {
+                    clparse_err = CLPARSE_ERR_KIND_MISSING_VALUE;
+                    return false;
+                }
 
-                    for (size_t i = prev_lst_len; i < flag->kind.lst.len; ++i) {
-                        ((const cchar**)flag->kind.lst.items)[i] = argv[arg++];
-                    }
-                    assert((init_arg + lst_len == (size_t)arg) &&
-                           "argument parsing failed");
+                slot = findChoice(table, value);
+                if (slot == 0) {
+                    clparse_err = CLPARSE_ERR_KIND_INVALID_CHOICE;
+                    err_flag = flag;
+                    err_value = value;
+                    return false;
                 }
-                break;
+                flag->kind.choice.index = slot - 1;
             }
             break;
 
+#ifdef CLPARSE_PREFETCH
+            case FLAG_TYPE_PATH:
+                if (!value) {
+                    clparse_err = CLPARSE_ERR_KIND_MISSING_VALUE;
+                    return false;
+                }
+                startPathJob(flag->kind.path, value);
+                break;
+#endif // CLPARSE_PREFETCH
+
             default:
                 assert(false && "Unreatchable(clparseParse)");
                 return false;
         }
     }
 
+    if (!clparseIsHelp() && !checkConstraints(flags, constraints)) return false;
+#ifdef CLPARSE_PREFETCH
+    if (!finishPathJobs(flags, total_flags_count)) return false;
+#endif // CLPARSE_PREFETCH
+
+    computeFingerprint();
     return true;
 }
 
 #undef IMPL_PARSE_INTEGER
-#undef IMPL_PARSE_INTEGER_LIST
+#undef IMPL_PARSE_LIST
+#undef IMPL_PARSE_LIST_PARALLEL
+#undef IMPL_CONVERT_INTEGER
+#undef IMPL_CONVERT_BOOL
+#undef IMPL_CONVERT_STRING
+
+void clparseIterInit(ClparseIter* iter, int argc, cchar** argv) {
+    iter->argc = argc;
+    iter->argv = argv;
+    iter->arg = 1;
+    iter->subcmd = SIZE_MAX;
+    iter->list_flag = NULL;
+    iter->is_numeric_list = false;
+    iter->is_inline_list = false;
+    iter->pending = NULL;
+    iter->is_passthrough = false;
+}
 
-bool* clparseSubcmd(const cchar* subcmd_name, const cchar* desc) {
-    assert(subcommands_len < SUBCOMMAND_CAPACITY);
+bool clparseNext(ClparseIter* iter, ClparseEvent* event) {
+    Flag *flags, *flag;
+    size_t flags_len;
+    cchar* inline_value = NULL;
+    cchar* token;
+
+    event->handle = NULL;
+    event->name = NULL;
+    event->value = NULL;
+    event->value_len = 0;
+
+    for (;;) {
+        // yields items of a list one by one
+        if (iter->pending) {
+            const cchar* comma;
+            flag = (Flag*)iter->list_flag;
+            comma = isSplitList(flag) ? cstrchr(iter->pending, CSTR(',')) : NULL;
+
+            event->kind = CLPARSE_EVENT_FLAG;
+            event->handle = &flag->kind;
+            event->name = flag->name;
+            event->value = iter->pending;
+            event->value_len = comma ? (size_t)(comma - iter->pending) : cstrlen(iter->pending);
+            iter->pending = comma ? comma + 1 : NULL;
+            return true;
+        }
+
+        if (iter->list_flag && !iter->is_inline_list && iter->arg < iter->argc &&
+                isListTag(classifyToken(iter->argv[iter->arg]), iter->is_numeric_list)) {
+            iter->pending = iter->argv[iter->arg++];
+            continue;
+        }
+        iter->list_flag = NULL;
+
+        if (iter->arg >= iter->argc) {
+            event->kind = CLPARSE_EVENT_END;
+            return false;
+        }
+
+        token = iter->argv[iter->arg++];
+        if (iter->is_passthrough) {
+            event->kind = CLPARSE_EVENT_PASSTHROUGH;
+            event->value = token;
+            event->value_len = cstrlen(token);
+            return true;
+        }
+        if (cstrcmp(token, CSTR("--")) != 0) break;
+        iter->is_passthrough = true;
+    }
+
+    if (token[0] != CSTR('-')) {
+        size_t pos;
+
+        if (iter->arg == 2 && subcommands_len > 0) {
+            if (!findSubcmdPosition(&pos, token)) {
+                clparse_err = CLPARSE_ERR_KIND_SUBCOMMAND_FIND;
+                event->kind = CLPARSE_EVENT_ERROR;
+                return false;
+            }
+            if (!buildSubcmd(&subcommands[pos])) {
+                event->kind = CLPARSE_EVENT_ERROR;
+                return false;
+            }
+            iter->subcmd = pos;
+            event->kind = CLPARSE_EVENT_SUBCMD;
+            event->handle = &subcommands[pos].is_activate;
+            event->name = subcommands[pos].name;
+            return true;
+        }
+
+        event->kind = CLPARSE_EVENT_POSITIONAL;
+        event->value = token;
+        event->value_len = cstrlen(token);
+        return true;
+    }
+
+    if (iter->subcmd != SIZE_MAX) {
+        flags = subcommands[iter->subcmd].flags;
+        flags_len = subcommands[iter->subcmd].flags_len;
+    } else {
+        flags = main_flags;
+        flags_len = main_flags_len;
+    }
 
+    flag = findFlag(flags, flags_len, token, cstrlen(token), &inline_value);
+    if (!flag) {
+        event->kind = CLPARSE_EVENT_ERROR;
+        return false;
+    }
+
+    event->kind = CLPARSE_EVENT_FLAG;
+    event->handle = &flag->kind;
+    event->name = flag->name;
+
+    switch (flag->type) {
+        case FLAG_TYPE_BOOL:
+            event->value = inline_value;
+            break;
+
+        case FLAG_TYPE_LIST:
+            iter->list_flag = flag;
+            iter->is_numeric_list = flag->kind.lst.kind != ARRAY_LIST_BOOL &&
+                                    flag->kind.lst.kind != ARRAY_LIST_STRING;
+            iter->is_inline_list = inline_value != NULL;
+            if (inline_value) {
+                iter->pending = inline_value;
+            } else if (iter->arg < iter->argc &&
+                    isListTag(classifyToken(iter->argv[iter->arg]), iter->is_numeric_list)) {
+                iter->pending = iter->argv[iter->arg++];
+            } else {
+                // a list flag without values is yielded once with no value
+                return true;
+            }
+            return clparseNext(iter, event);
+
+        default:
+            if (inline_value) {
+                event->value = inline_value;
+            } else if (iter->arg < iter->argc) {
+                event->value = iter->argv[iter->arg++];
+            } else {
+                clparse_err = CLPARSE_ERR_KIND_MISSING_VALUE;
+                event->kind = CLPARSE_EVENT_ERROR;
+                return false;
+            }
+            break;
+    }
+
+    if (event->value) event->value_len = cstrlen(event->value);
+    return true;
+}
+
+bool* clparseSubcmd(const cchar* subcmd_name, const cchar* desc) {
     HashBox* hash_box;
     Subcmd* subcmd;
     size_t hash = clparseHash(subcmd_name);
 
+    if (subcommands_len >= SUBCOMMAND_CAPACITY) {
+        clparse_err = CLPARSE_ERR_KIND_CAPACITY_EXCEEDED;
+        return NULL;
+    }
+
     if (hash_map[hash].next) {
         hash_box = hash_map[hash].next;
         while (hash_box->next) hash_box = hash_box->next;
@@ -778,6 +1818,10 @@ bool* clparseSubcmd(const cchar* subcmd_name, const cchar* desc) {
     subcmd->is_activate = false;
     subcmd->main_args_len = 0;
     subcmd->flags_len = 0;
+    subcmd->builder = NULL;
+    subcmd->builder_ctx = NULL;
+    subcmd->build_err = CLPARSE_ERR_KIND_OK;
+    subcmd->build_err_detail = NULL;
 
     help_cmd[help_cmd_len++] =
         clparseBool(CSTR("help"), CSTR('h'), false,
@@ -786,6 +1830,20 @@ bool* clparseSubcmd(const cchar* subcmd_name, const cchar* desc) {
     return &subcmd->is_activate;
 }
 
+bool* clparseSubcmdLazy(
+    const cchar* subcmd_name,
+    const cchar* desc,
+    ClparseSubcmdBuilder builder,
+    void* ctx
+) {
+    bool* is_activate = clparseSubcmd(subcmd_name, desc);
+    if (!is_activate) return NULL;
+
+    subcommands[subcommands_len - 1].builder = builder;
+    subcommands[subcommands_len - 1].builder_ctx = ctx;
+    return is_activate;
+}
+
 const cchar** clparseMainArg(
     const cchar* name,
     const cchar* desc,
@@ -793,7 +1851,7 @@ const cchar** clparseMainArg(
 ) {
     MainArg* main_arg = clparseGetMainArg(subcmd);
     if (!main_arg) {
-        if (!err_msg_detail) clparse_err = CLPARSE_ERR_KIND_SUBCOMMAND_FIND;
+        if (clparse_err == CLPARSE_ERR_KIND_OK) clparse_err = CLPARSE_ERR_KIND_SUBCOMMAND_FIND;
         return NULL;
     }
 
@@ -804,17 +1862,48 @@ const cchar** clparseMainArg(
     return &main_arg->value;
 }
 
-#define T(_name, _type, _arg, _flag_type, _foo)                                \
-    _type* clparse##_name(                                                     \
-        const cchar* flag_name,                                                \
-        cchar short_name,                                                      \
-        _type dfault,                                                          \
+const ArgvSlice* clparseMainArgs(
+    const cchar* name,
+    const cchar* desc,
+    const cchar* subcmd
+) {
+    MainArg* variadic = &main_variadic;
+    ArgvSlice* variadic_args = &main_variadic_args;
+
+    if (subcmd) {
+        size_t pos;
+        if (!findSubcmdPosition(&pos, subcmd)) {
+            clparse_err = CLPARSE_ERR_KIND_SUBCOMMAND_FIND;
+            return NULL;
+        }
+        variadic = &subcommands[pos].variadic;
+        variadic_args = &subcommands[pos].variadic_args;
+    }
+
+    variadic->name = name;
+    variadic->value = NULL;
+    variadic->desc = desc;
+    variadic_args->items = NULL;
+    variadic_args->len = 0;
+
+    return variadic_args;
+}
+
+const ArgvSlice* clparsePassthrough(void) {
+    return &passthrough_args;
+}
+
+#define T(_name, _type, _arg, _flag_type, _foo)                                \
+    _type* clparse##_name(                                                     \
+        const cchar* flag_name,                                                \
+        cchar short_name,                                                      \
+        _type dfault,                                                          \
         const cchar* desc,                                                     \
         const cchar* subcmd                                                    \
     ) {                                                                        \
         Flag* flag = clparseGetFlag(subcmd);                                   \
         if (!flag) {                                                           \
-            if (!err_msg_detail) {                                             \
+            if (clparse_err == CLPARSE_ERR_KIND_OK) {                          \
                 clparse_err = CLPARSE_ERR_KIND_SUBCOMMAND_FIND;                \
             }                                                                  \
             return NULL;                                                       \
@@ -845,7 +1934,7 @@ CLPARSE_TYPES(T)
         (void)dfault;                                                          \
         Flag* flag = clparseGetFlag(subcmd);                                   \
         if (!flag) {                                                           \
-            if (!err_msg_detail) {                                             \
+            if (clparse_err == CLPARSE_ERR_KIND_OK) {                          \
                 clparse_err = CLPARSE_ERR_KIND_SUBCOMMAND_FIND;                \
             }                                                                  \
             return NULL;                                                       \
@@ -866,182 +1955,3116 @@ CLPARSE_TYPES(T)
 CLPARSE_TYPES(T)
 #undef T
 
-// TODO: implement better and clean error printing message
-const char* clparseGetErr(void) {
-    switch (clparse_err) {
-    case CLPARSE_ERR_KIND_OK:
+const RangeList* clparseRange(
+    const cchar* flag_name,
+    cchar short_name,
+    const cchar* desc,
+    const cchar* subcmd
+) {
+    Flag* flag = clparseGetFlag(subcmd);
+    if (!flag) {
+        if (clparse_err == CLPARSE_ERR_KIND_OK) clparse_err = CLPARSE_ERR_KIND_SUBCOMMAND_FIND;
         return NULL;
+    }
 
-    case CLPARSE_ERR_KIND_SUBCOMMAND_FIND:
-        return "Cannot find an appropriate subcommnads";
+    flag->name = flag_name;
+    flag->short_name = short_name;
+    flag->type = FLAG_TYPE_RANGE;
+    flag->kind.rng.items = NULL;
+    flag->kind.rng.ends = NULL;
+    flag->kind.rng.len = 0;
+    flag->desc = desc;
 
-    case CLPARSE_ERR_KIND_FLAG_FIND:
-        return "Cannot find an appropriate flag";
+    return &flag->kind.rng;
+}
 
-    case CLPARSE_ERR_KIND_MAIN_ARGS_NUM_OVERFLOWED:
-        return "Too many main arguments are given";
+const size_t* clparseChoice(
+    const cchar* flag_name,
+    cchar short_name,
+    size_t dfault,
+    const cchar* const* choices,
+    size_t choices_len,
+    const cchar* desc,
+    const cchar* subcmd
+) {
+    if (!choices || choices_len == 0 || dfault >= choices_len) {
+        clparse_err = CLPARSE_ERR_KIND_INVALID_CHOICES;
+        err_msg_detail = choices_len == 0 ? "no choices" : "default out of choices";
+        return NULL;
+    }
 
-    case CLPARSE_ERR_KIND_INAVLID_NUMBER:
-        return "Invalid number or overflowed number is given";
+    ChoiceTable* table = buildChoiceTable(choices, choices_len);
+    if (!table) return NULL;
 
-    case CLPARSE_ERR_KIND_LONG_FLAG_WITH_SHORT_FLAG:
-        return "Long flags must start with `--`, not `-`";
+    Flag* flag = clparseGetFlag(subcmd);
+    if (!flag) {
+        free(table);
+        if (clparse_err == CLPARSE_ERR_KIND_OK) clparse_err = CLPARSE_ERR_KIND_SUBCOMMAND_FIND;
+        return NULL;
+    }
 
-    case CLPARSE_INTERNAL_ERROR:
-        snprintf(internal_err_msg, 200, "Internal error was found at %s",
-                 err_msg_detail);
-        internal_err_msg[200] = '\0';
-        return internal_err_msg;
+    flag->name = flag_name;
+    flag->short_name = short_name;
+    flag->type = FLAG_TYPE_CHOICE;
+    flag->kind.choice.index = dfault;
+    flag->kind.choice.table = table;
+    flag->dfault.choice = flag->kind.choice;
+    flag->desc = desc;
 
-    default:
-        assert(false && "Unreatchable (clparseGetErr)");
-        return "";
+    return &flag->kind.choice.index;
+}
+
+// returns the index of the last interval whose `lo` is not greater than value,
+// or rng->len if there is no such interval
+static size_t findRangeInterval(const RangeList* rng, uint64_t value) {
+    size_t lo = 0, hi = rng->len;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (rng->items[mid].lo <= value) lo = mid + 1;
+        else hi = mid;
     }
+
+    return lo == 0 ? rng->len : lo - 1;
 }
 
-#if defined(_WIN32) && !defined(NO_USE_WIDE_ARGV)
-bool clparseGetCmdlineW(int* argc, LPWSTR** argv) {
-    LPWSTR args = GetCommandLineW();
-    *argv = CommandLineToArgvW(args, argc);
-    return *argv != NULL;
+bool clparseRangeContains(const RangeList* rng, uint64_t value) {
+    size_t idx = findRangeInterval(rng, value);
+    if (idx >= rng->len) return false;
+
+    const RangeInterval* interval = &rng->items[idx];
+    return value <= interval->hi && (value - interval->lo) % interval->step == 0;
 }
 
-void clparseFreeCmdlineW(const LPWSTR* argv) {
-    LocalFree((void*)argv);
+uint64_t clparseRangeCount(const RangeList* rng) {
+    return rng->len > 0 ? rng->ends[rng->len - 1] : 0;
 }
-#endif
 
-/************************************/
-/* Static Functions Implementations */
-/************************************/
-static MainArg* clparseGetMainArg(const cchar* subcmd) {
-    MainArg* main_arg;
+bool clparseRangeNth(const RangeList* rng, uint64_t nth, uint64_t* output) {
+    size_t lo = 0, hi = rng->len;
 
-    if (subcmd) {
-        size_t pos;
-        if (!findSubcmdPosition(&pos, subcmd)) return NULL;
-        Subcmd* subcmd = &subcommands[pos];
-        if (subcmd->main_args_len >= MAIN_ARGS_CAPACITY) {
-            clparse_err = CLPARSE_ERR_KIND_MAIN_ARGS_NUM_OVERFLOWED;
-            return NULL;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (rng->ends[mid] <= nth) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo >= rng->len) return false;
+
+    uint64_t prev_end = lo > 0 ? rng->ends[lo - 1] : 0;
+    *output = rng->items[lo].lo + (nth - prev_end) * rng->items[lo].step;
+    return true;
+}
+
+bool clparseRangeLowerBound(const RangeList* rng, uint64_t value, uint64_t* output) {
+    size_t idx = findRangeInterval(rng, value);
+
+    if (idx >= rng->len) {
+        if (rng->len == 0) return false;
+        *output = rng->items[0].lo;
+        return true;
+    }
+
+    const RangeInterval* interval = &rng->items[idx];
+    if (value <= interval->hi) {
+        uint64_t rem = (value - interval->lo) % interval->step;
+        *output = rem == 0 ? value : value + (interval->step - rem);
+        return true;
+    }
+
+    if (idx + 1 >= rng->len) return false;
+    *output = rng->items[idx + 1].lo;
+    return true;
+}
+
+bool clparseRequired(const void* flag) {
+    HandleKind kind;
+    size_t scope, idx;
+
+    if (!resolveHandle(flag, &kind, &scope, &idx) || kind != HANDLE_FLAG) {
+        clparse_err = CLPARSE_ERR_KIND_INVALID_CONSTRAINT;
+        return false;
+    }
+
+    ScopeConstraints* constraints = scope == 0 ? &main_constraints
+                                               : &subcommands[scope - 1].constraints;
+    FLAG_MASK_SET(constraints->required, idx);
+    return true;
+}
+
+bool clparseExclusive(const void* const* flags, size_t flags_len) {
+    FlagConstraint* constraint;
+    size_t first_scope = 0, scope, idx, other_idx;
+
+    // every flag is checked and given its constraint first, so that a failure
+    // leaves no part of the conflicts behind (an empty constraint does nothing)
+    for (size_t i = 0; i < flags_len; ++i) {
+        HandleKind kind;
+        if (!resolveHandle(flags[i], &kind, &scope, &idx) || kind != HANDLE_FLAG ||
+                (i > 0 && scope != first_scope)) {
+            clparse_err = CLPARSE_ERR_KIND_INVALID_CONSTRAINT;
+            return false;
         }
-        main_arg = &subcmd->main_args[subcmd->main_args_len++];
+        first_scope = scope;
     }
-    else {
-        if (main_args_len >= MAIN_ARGS_CAPACITY) {
-            clparse_err = CLPARSE_ERR_KIND_MAIN_ARGS_NUM_OVERFLOWED;
-            return NULL;
+    for (size_t i = 0; i < flags_len; ++i) {
+        if (!getFlagConstraint(flags[i], &scope, &idx)) return false;
+    }
+
+    // the constraints exist now, so nothing below can fail
+    for (size_t i = 0; i < flags_len; ++i) {
+        constraint = getFlagConstraint(flags[i], &scope, &idx);
+
+        for (size_t j = 0; j < flags_len; ++j) {
+            HandleKind kind;
+            resolveHandle(flags[j], &kind, &scope, &other_idx);
+            if (other_idx != idx) FLAG_MASK_SET(constraint->conflicts, other_idx);
         }
-        main_arg = &main_main_args[main_args_len++];
     }
 
-    return main_arg;
+    return true;
 }
 
-static void deinitFlag(Flag* flag) {
-    if (flag->type == FLAG_TYPE_LIST) {
-        free(flag->kind.lst.items);
-        flag->kind.lst.items = NULL;
-        flag->kind.lst.len = 0;
+bool clparseRequires(const void* flag, const void* dependency) {
+    FlagConstraint* constraint;
+    HandleKind kind;
+    size_t scope, dependency_scope, idx, dependency_idx;
+
+    if (!resolveHandle(dependency, &kind, &dependency_scope, &dependency_idx) ||
+            kind != HANDLE_FLAG) {
+        clparse_err = CLPARSE_ERR_KIND_INVALID_CONSTRAINT;
+        return false;
     }
+    if (!resolveHandle(flag, &kind, &scope, &idx) || kind != HANDLE_FLAG ||
+            scope != dependency_scope) {
+        clparse_err = CLPARSE_ERR_KIND_INVALID_CONSTRAINT;
+        return false;
+    }
+
+    constraint = getFlagConstraint(flag, &scope, &idx);
+    if (!constraint) return false;
+    FLAG_MASK_SET(constraint->dependencies, dependency_idx);
+    return true;
 }
 
-static Flag* clparseGetFlag(const cchar* subcmd) {
+#ifdef CLPARSE_PREFETCH
+const ClparsePath* clparsePath(
+    const cchar* flag_name,
+    cchar short_name,
+    const cchar* dfault,
+    int checks,
+    const cchar* desc,
+    const cchar* subcmd
+) {
+    PathJob* job;
     Flag* flag;
 
-    if (subcmd != NO_SUBCMD) {
-        size_t pos;
-        if (!findSubcmdPosition(&pos, subcmd)) return NULL;
-
-        size_t* idx = &subcommands[pos].flags_len;
-        assert(*idx < FLAG_CAPACITY);
+    if (path_jobs_len >= PATH_FLAG_CAPACITY) {
+        clparse_err = CLPARSE_ERR_KIND_CAPACITY_EXCEEDED;
+        return NULL;
+    }
 
-        flag = &subcommands[pos].flags[(*idx)++];
+    flag = clparseGetFlag(subcmd);
+    if (!flag) {
+        if (clparse_err == CLPARSE_ERR_KIND_OK) clparse_err = CLPARSE_ERR_KIND_SUBCOMMAND_FIND;
+        return NULL;
     }
-    else {
-        assert(main_flags_len < FLAG_CAPACITY);
-        flag = &main_flags[main_flags_len++];
+
+    job = &path_jobs[path_jobs_len++];
+    memset(job, 0, sizeof(PathJob));
+    job->flag = flag;
+    job->path.fd = -1;
+    job->dfault = dfault;
+    job->checks = checks;
+
+    flag->name = flag_name;
+    flag->short_name = short_name;
+    flag->type = FLAG_TYPE_PATH;
+    flag->kind.path = job;
+    flag->dfault.path = job;
+    flag->desc = desc;
+
+    return &job->path;
+}
+
+const ClparsePath* clparsePathWait(const ClparsePath* path) {
+    joinPathJob((PathJob*)path);
+    return path;
+}
+
+int clparsePathTakeFd(const ClparsePath* path) {
+    PathJob* job = (PathJob*)path;
+    int fd;
+
+    joinPathJob(job);
+    fd = job->path.fd;
+    job->path.fd = -1;
+    return fd;
+}
+
+// An output path need not be readable, or even exist when EXISTS is not asked.
+// Returns the errno of the check, or 0
+static int checkPathWritable(const PathJob* job, int open_err) {
+    const cchar* path = job->path.path;
+    const cchar* slash;
+    cchar* dir;
+    int err = 0;
+
+    if (open_err != ENOENT) {
+        if (access(path, W_OK) != 0) return errno;
+        return 0;
     }
+    if (job->checks & CLPARSE_PATH_EXISTS) return open_err;
 
-    return flag;
+    // a missing file can be created when its directory is writable
+    slash = strrchr(path, '/');
+    if (!slash) return access(".", W_OK | X_OK) != 0 ? errno : 0;
+    if (slash == path) return access("/", W_OK | X_OK) != 0 ? errno : 0;
+
+    dir = (cchar*)malloc(sizeof(cchar) * (size_t)(slash - path + 1));
+    if (!dir) return ENOMEM;
+    memcpy(dir, path, sizeof(cchar) * (size_t)(slash - path));
+    dir[slash - path] = '\0';
+    if (access(dir, W_OK | X_OK) != 0) err = errno;
+    free(dir);
+
+    return err;
 }
 
-static size_t clparseHash(const cchar* letter) {
-    uint32_t hash = 0x811c9dc5;
-    const uint32_t prime = 16777619;
-    while (*letter) {
-        hash = ((uint32_t)*letter++ ^ hash) * prime;
+static void* prefetchPath(void* arg) {
+    PathJob* job = (PathJob*)arg;
+#ifdef O_CLOEXEC
+    int fd = open(job->path.path, O_RDONLY | O_CLOEXEC);
+#else
+    // a strict `-std=` without POSIX.1-2008 hides O_CLOEXEC, so a concurrent
+    // fork may inherit the fd
+    int fd = open(job->path.path, O_RDONLY);
+    if (fd >= 0) (void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif // O_CLOEXEC
+
+    if (fd < 0) {
+        job->path.err = errno;
+        if ((job->checks & CLPARSE_PATH_WRITABLE) && !(job->checks & CLPARSE_PATH_READABLE)) {
+            job->path.err = checkPathWritable(job, job->path.err);
+            if (job->path.err == 0 && stat(job->path.path, &job->path.st) != 0) {
+                memset(&job->path.st, 0, sizeof(struct stat));
+            }
+        }
+        return NULL;
     }
-    return hash ^ (hash >> 10) << 10;
+    if (fstat(fd, &job->path.st) != 0) {
+        job->path.err = errno;
+        close(fd);
+        return NULL;
+    }
+
+    // only a hint, so its failure (or its absence) does not matter
+#ifdef POSIX_FADV_WILLNEED
+    if (S_ISREG(job->path.st.st_mode)) (void)posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif // POSIX_FADV_WILLNEED
+    if ((job->checks & CLPARSE_PATH_WRITABLE) && access(job->path.path, W_OK) != 0) {
+        job->path.err = errno;
+        close(fd);
+        return NULL;
+    }
+    job->path.fd = fd;
+
+    return NULL;
 }
 
-static bool findSubcmdPosition(size_t* output, const cchar* subcmd_name) {
-    size_t hash = clparseHash(subcmd_name);
-    HashBox* hashbox = &hash_map[hash];
+// starts prefetching path, dropping what a previous occurrence of the flag opened
+static void startPathJob(PathJob* job, const cchar* path) {
+    joinPathJob(job);
+    if (job->path.fd >= 0) close(job->path.fd);
 
-    if (!hashbox->name) return false;
+    job->path.path = path;
+    job->path.fd = -1;
+    job->path.err = 0;
+    memset(&job->path.st, 0, sizeof(struct stat));
+    if (!path) return;
 
-    while (hashbox && cstrcmp(subcmd_name, hashbox->name) != 0) {
-        hashbox = hashbox->next;
+    job->is_running = pthread_create(&job->thread, NULL, prefetchPath, job) == 0;
+    if (!job->is_running) prefetchPath(job);
+}
+
+static void joinPathJob(PathJob* job) {
+    if (!job->is_running) return;
+    pthread_join(job->thread, NULL);
+    job->is_running = false;
+}
+
+// A check rejects a path which cannot be opened, except that CLPARSE_PATH_EXISTS
+// alone only rejects a missing one
+static bool isPathRejected(const PathJob* job) {
+    if (!job->path.path || job->path.err == 0 || job->checks == CLPARSE_PATH_ANY) return false;
+    if (job->checks & (CLPARSE_PATH_READABLE | CLPARSE_PATH_WRITABLE)) return true;
+    return job->path.err == ENOENT || job->path.err == ENOTDIR;
+}
+
+// starts defaults of path flags which are not given, and waits for the ones
+// with checks
+static bool finishPathJobs(Flag* flags, size_t flags_len) {
+    for (size_t i = 0; i < flags_len; ++i) {
+        if (flags[i].type != FLAG_TYPE_PATH) continue;
+        PathJob* job = flags[i].kind.path;
+        if (!job->path.path && job->dfault) startPathJob(job, job->dfault);
     }
 
-    if (!hashbox) return false;
+    for (size_t i = 0; i < flags_len; ++i) {
+        if (flags[i].type != FLAG_TYPE_PATH || flags[i].kind.path->checks == CLPARSE_PATH_ANY) {
+            continue;
+        }
+        joinPathJob(flags[i].kind.path);
+        if (isPathRejected(flags[i].kind.path)) {
+            clparse_err = CLPARSE_ERR_KIND_INVALID_PATH;
+            err_flag = &flags[i];
+            return false;
+        }
+    }
 
-    *output = hashbox->where;
     return true;
 }
+#endif // CLPARSE_PREFETCH
+
+#ifdef CLPARSE_SNAPSHOT
+#if defined(_MSC_VER) && !defined(__clang__)
+#   define CLPARSE_ATOMIC_LOAD_U64(_ptr)                                       \
+        ((uint64_t)InterlockedCompareExchange64((volatile LONG64*)(_ptr), 0, 0))
+#   define CLPARSE_ATOMIC_STORE_U64(_ptr, _val)                                \
+        InterlockedExchange64((volatile LONG64*)(_ptr), (LONG64)(_val))
+#   define CLPARSE_ATOMIC_FETCH_ADD_U64(_ptr, _val)                            \
+        ((uint64_t)InterlockedExchangeAdd64((volatile LONG64*)(_ptr), (LONG64)(_val)))
+#   define CLPARSE_ATOMIC_CAS_U32(_ptr, _expected, _desired)                   \
+        (InterlockedCompareExchange((volatile LONG*)(_ptr), (LONG)(_desired),  \
+                                    (LONG)(_expected)) == (LONG)(_expected))
+#   define CLPARSE_ATOMIC_STORE_U32(_ptr, _val)                                \
+        InterlockedExchange((volatile LONG*)(_ptr), (LONG)(_val))
+#   define CLPARSE_ATOMIC_LOAD_PTR(_ptr)                                       \
+        InterlockedCompareExchangePointer((PVOID volatile*)(_ptr), NULL, NULL)
+#   define CLPARSE_ATOMIC_EXCHANGE_PTR(_ptr, _val)                             \
+        InterlockedExchangePointer((PVOID volatile*)(_ptr), (PVOID)(_val))
+#else
+#   define CLPARSE_ATOMIC_LOAD_U64(_ptr) __atomic_load_n(_ptr, __ATOMIC_SEQ_CST)
+#   define CLPARSE_ATOMIC_STORE_U64(_ptr, _val)                                \
+        __atomic_store_n(_ptr, _val, __ATOMIC_SEQ_CST)
+#   define CLPARSE_ATOMIC_FETCH_ADD_U64(_ptr, _val)                            \
+        __atomic_fetch_add(_ptr, _val, __ATOMIC_SEQ_CST)
+#   define CLPARSE_ATOMIC_CAS_U32(_ptr, _expected, _desired)                   \
+        __extension__ ({                                                       \
+            uint32_t expected_ = (_expected);                                  \
+            __atomic_compare_exchange_n(_ptr, &expected_, _desired, false,     \
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);   \
+        })
+#   define CLPARSE_ATOMIC_STORE_U32(_ptr, _val)                                \
+        __atomic_store_n(_ptr, _val, __ATOMIC_SEQ_CST)
+#   define CLPARSE_ATOMIC_LOAD_PTR(_ptr) __atomic_load_n(_ptr, __ATOMIC_SEQ_CST)
+#   define CLPARSE_ATOMIC_EXCHANGE_PTR(_ptr, _val)                             \
+        __atomic_exchange_n(_ptr, _val, __ATOMIC_SEQ_CST)
+#endif // _MSC_VER
+
+bool clparsePublish(void) {
+    ClparseSnapshot* snapshot = buildSnapshot();
+    if (!snapshot) return false;
+
+    ClparseSnapshot* old = (ClparseSnapshot*)CLPARSE_ATOMIC_EXCHANGE_PTR(&current_snapshot, snapshot);
+    if (old) {
+        // readers which have entered before this point may still see old
+        old->retired_epoch = CLPARSE_ATOMIC_FETCH_ADD_U64(&snapshot_epoch, 1);
+        old->next_retired = retired_snapshots;
+        retired_snapshots = old;
+    }
 
-static void freeNextHashBox(HashBox* hashbox) {
-    if (!hashbox) return;
+    reclaimSnapshots(false);
+    return true;
+}
 
-    HashBox* next = hashbox->next;
-    while (next) {
-        hashbox = next;
-        next = next->next;
-        free(hashbox);
+bool clparseReparse(int argc, cchar** argv) {
+    clparse_err = CLPARSE_ERR_KIND_OK;
+    return clparseParse(argc, argv) && clparsePublish();
+}
+
+ClparseReader* clparseReaderRegister(void) {
+    for (size_t i = 0; i < CLPARSE_READERS_CAPACITY; ++i) {
+        if (CLPARSE_ATOMIC_CAS_U32(&snapshot_readers[i].is_used, 0, 1)) {
+            CLPARSE_ATOMIC_STORE_U64(&snapshot_readers[i].epoch, 0);
+            return &snapshot_readers[i];
+        }
     }
+    return NULL;
 }
 
-static bool isTruthy(const cchar* string) {
-    if (!string) return false;
+void clparseReaderUnregister(ClparseReader* reader) {
+    CLPARSE_ATOMIC_STORE_U64(&reader->epoch, 0);
+    CLPARSE_ATOMIC_STORE_U32(&reader->is_used, 0);
+}
 
-    switch (string[0]) {
-    case CSTR('t'):
-    case CSTR('T'):
-        if (!string[1]) return true;
-        return cstrcmp(string + 1, CSTR("rue")) == 0;
+const ClparseSnapshot* clparseReadLock(ClparseReader* reader) {
+    // the epoch must be visible before the snapshot is loaded
+    CLPARSE_ATOMIC_STORE_U64(&reader->epoch, CLPARSE_ATOMIC_LOAD_U64(&snapshot_epoch));
+    return (const ClparseSnapshot*)CLPARSE_ATOMIC_LOAD_PTR(&current_snapshot);
+}
 
-    default:
-        return false;
+void clparseReadUnlock(ClparseReader* reader) {
+    CLPARSE_ATOMIC_STORE_U64(&reader->epoch, 0);
+}
+
+// Like resolveHandle, but only with addresses and the lengths in the snapshot,
+// so that readers never look at what the writer may be changing. idx is the
+// index into the values of the snapshot.
+static bool resolveSnapshotHandle(
+    const ClparseSnapshot* snapshot,
+    const void* handle,
+    HandleKind* kind,
+    size_t* scope,
+    size_t* idx
+) {
+    uintptr_t ptr = (uintptr_t)handle;
+    const Flag* flags = main_flags;
+    const MainArg* args = main_main_args;
+
+    *scope = 0;
+    *idx = 0;
+    if (handle == &passthrough_args) {
+        *kind = HANDLE_PASSTHROUGH;
+        return true;
+    }
+    if (handle == &main_variadic_args) {
+        *kind = HANDLE_VARIADIC;
+        return true;
+    }
+    if (ptr >= (uintptr_t)subcommands &&
+            ptr < (uintptr_t)(subcommands + snapshot->subcommands_len)) {
+        size_t pos = (ptr - (uintptr_t)subcommands) / sizeof(Subcmd);
+        *scope = pos + 1;
+        if (handle == &subcommands[pos].is_activate) {
+            *kind = HANDLE_SUBCMD;
+            return true;
+        }
+        if (handle == &subcommands[pos].variadic_args) {
+            *kind = HANDLE_VARIADIC;
+            return true;
+        }
+        flags = subcommands[pos].flags;
+        args = subcommands[pos].main_args;
     }
+
+    size_t flags_len = snapshot->flag_offsets[*scope + 1] - snapshot->flag_offsets[*scope];
+    size_t args_len = snapshot->arg_offsets[*scope + 1] - snapshot->arg_offsets[*scope];
+    if (ptr >= (uintptr_t)flags && ptr < (uintptr_t)(flags + flags_len)) {
+        size_t pos = (ptr - (uintptr_t)flags) / sizeof(Flag);
+        *idx = snapshot->flag_offsets[*scope] + pos;
+        *kind = HANDLE_FLAG;
+        return handle == &flags[pos].kind;
+    }
+    if (ptr >= (uintptr_t)args && ptr < (uintptr_t)(args + args_len)) {
+        size_t pos = (ptr - (uintptr_t)args) / sizeof(MainArg);
+        *idx = snapshot->arg_offsets[*scope] + pos;
+        *kind = HANDLE_MAIN_ARG;
+        return handle == &args[pos].value;
+    }
+
+#ifdef CLPARSE_PREFETCH
+    if (ptr >= (uintptr_t)path_jobs && ptr < (uintptr_t)(path_jobs + snapshot->path_jobs_len)) {
+        size_t pos = (ptr - (uintptr_t)path_jobs) / sizeof(PathJob);
+        *idx = snapshot->path_slots[pos];
+        *kind = HANDLE_FLAG;
+        return handle == &path_jobs[pos].path;
+    }
+#endif // CLPARSE_PREFETCH
+
+    return false;
 }
 
-int cprintf_impl_(const cchar* fmt, ...) {
-#ifdef USE_WIDE_ARGV
-    va_list args;
-    va_start(args, fmt);
-#ifdef _WIN32
-    int len = vswprintf(NULL, 0, fmt, args);
-#else
-    int len = vfwprintf(stderr, fmt, args);
-#endif // _WIN32
-    va_end(args);
-#ifndef _WIN32
-    return len;
-#endif // !_WIN32
-    if (len < 0) return -1;
+const void* clparseSnapshotGet(const ClparseSnapshot* snapshot, const void* handle) {
+    HandleKind kind;
+    size_t scope, idx;
 
-    wchar_t* buf = (wchar_t*)malloc(sizeof(wchar_t) * len);
-    va_start(args, fmt);
-    len = vswprintf(buf, len + 1, fmt, args);
-    va_end(args);
-    if (len < 0) return -1;
+    // a handle made after the snapshot was taken is not found in it
+    if (!snapshot || !resolveSnapshotHandle(snapshot, handle, &kind, &scope, &idx)) return NULL;
 
-    DWORD written;
-    HANDLE stderr_h = GetStdHandle(STD_ERROR_HANDLE);
-    WriteConsoleW(stderr_h, buf, len, &written, NULL);
-    free(buf);
-    return written;
+    switch (kind) {
+    case HANDLE_FLAG:
+#ifdef CLPARSE_PREFETCH
+        if ((uintptr_t)handle >= (uintptr_t)path_jobs &&
+                (uintptr_t)handle < (uintptr_t)(path_jobs + PATH_FLAG_CAPACITY)) {
+            return &snapshot->kinds[idx].path->path;
+        }
+#endif // CLPARSE_PREFETCH
+        return &snapshot->kinds[idx];
+    case HANDLE_MAIN_ARG:
+        return &snapshot->args[idx];
+    case HANDLE_SUBCMD:
+        return &snapshot->activated[scope - 1];
+    case HANDLE_VARIADIC:
+        return &snapshot->variadics[scope];
+    case HANDLE_PASSTHROUGH:
+        return &snapshot->passthrough;
+    }
+    return NULL;
+}
+
+// bytes which a flag value needs besides its FlagKind
+static size_t snapshotFlagSize(const Flag* flag) {
+    size_t size = 0;
+
+    switch (flag->type) {
+    case FLAG_TYPE_STRING:
+        if (flag->kind.str) size = CLPARSE_ALIGN_UP(sizeof(cchar) * (cstrlen(flag->kind.str) + 1));
+        break;
+
+    case FLAG_TYPE_LIST:
+        switch (flag->kind.lst.kind) {
+#define T(_name, _type, _foo1, _foo2, _array_list_type)                        \
+        case _array_list_type:                                                 \
+            size = CLPARSE_ALIGN_UP(sizeof(_type) * flag->kind.lst.len);       \
+            break;
+
+        CLPARSE_TYPES(T)
+#undef T
+        }
+        if (flag->kind.lst.kind == ARRAY_LIST_STRING) {
+            for (size_t i = 0; i < flag->kind.lst.len; ++i) {
+                const cchar* item = ((const cchar**)flag->kind.lst.items)[i];
+                size += CLPARSE_ALIGN_UP(sizeof(cchar) * (cstrlen(item) + 1));
+            }
+        }
+        break;
+
+    case FLAG_TYPE_RANGE:
+        size = CLPARSE_ALIGN_UP((sizeof(RangeInterval) + sizeof(uint64_t)) * flag->kind.rng.len);
+        break;
+
+#ifdef CLPARSE_PREFETCH
+    case FLAG_TYPE_PATH:
+        size = CLPARSE_ALIGN_UP(sizeof(PathJob));
+        if (flag->kind.path->path.path) {
+            size += CLPARSE_ALIGN_UP(sizeof(cchar) * (cstrlen(flag->kind.path->path.path) + 1));
+        }
+        break;
+#endif // CLPARSE_PREFETCH
+
+    default:
+        break;
+    }
+
+    return size;
+}
+
+static const cchar* snapshotStr(const cchar* str, char** arena) {
+    size_t size;
+    cchar* copied;
+
+    if (!str) return NULL;
+    size = sizeof(cchar) * (cstrlen(str) + 1);
+    copied = (cchar*)*arena;
+    memcpy(copied, str, size);
+    *arena += CLPARSE_ALIGN_UP(size);
+    return copied;
+}
+
+static size_t snapshotSliceSize(const ArgvSlice* slice) {
+    size_t size = CLPARSE_ALIGN_UP(sizeof(cchar*) * slice->len);
+    for (size_t i = 0; i < slice->len; ++i) {
+        size += CLPARSE_ALIGN_UP(sizeof(cchar) * (cstrlen(slice->items[i]) + 1));
+    }
+    return size;
+}
+
+static void snapshotSlice(const ArgvSlice* slice, ArgvSlice* output, char** arena) {
+    output->items = (cchar**)*arena;
+    output->len = slice->len;
+    *arena += CLPARSE_ALIGN_UP(sizeof(cchar*) * slice->len);
+    for (size_t i = 0; i < slice->len; ++i) {
+        output->items[i] = (cchar*)snapshotStr(slice->items[i], arena);
+    }
+}
+
+static void snapshotFlag(const Flag* flag, FlagKind* output, char** arena) {
+    *output = flag->kind;
+
+    switch (flag->type) {
+    case FLAG_TYPE_STRING:
+        output->str = snapshotStr(flag->kind.str, arena);
+        break;
+
+    case FLAG_TYPE_LIST: {
+        size_t size = 0;
+        switch (flag->kind.lst.kind) {
+#define T(_name, _type, _foo1, _foo2, _array_list_type)                        \
+        case _array_list_type:                                                 \
+            size = sizeof(_type) * flag->kind.lst.len;                         \
+            break;
+
+        CLPARSE_TYPES(T)
+#undef T
+        }
+        output->lst.items = *arena;
+        if (size) memcpy(*arena, flag->kind.lst.items, size);
+        *arena += CLPARSE_ALIGN_UP(size);
+
+        if (flag->kind.lst.kind == ARRAY_LIST_STRING) {
+            const cchar** items = (const cchar**)output->lst.items;
+            for (size_t i = 0; i < flag->kind.lst.len; ++i) {
+                items[i] = snapshotStr(items[i], arena);
+            }
+        }
+    }
+    break;
+
+    case FLAG_TYPE_RANGE: {
+        size_t len = flag->kind.rng.len;
+        output->rng.items = (RangeInterval*)*arena;
+        output->rng.ends = (uint64_t*)(output->rng.items + len);
+        if (len) {
+            memcpy(output->rng.items, flag->kind.rng.items, sizeof(RangeInterval) * len);
+            memcpy(output->rng.ends, flag->kind.rng.ends, sizeof(uint64_t) * len);
+        }
+        *arena += CLPARSE_ALIGN_UP((sizeof(RangeInterval) + sizeof(uint64_t)) * len);
+    }
+    break;
+
+#ifdef CLPARSE_PREFETCH
+    // the copy has no thread and no fd, which stay with the flag
+    case FLAG_TYPE_PATH: {
+        PathJob* job = (PathJob*)*arena;
+        *arena += CLPARSE_ALIGN_UP(sizeof(PathJob));
+
+        joinPathJob(flag->kind.path);
+        memcpy(job, flag->kind.path, sizeof(PathJob));
+        job->path.path = snapshotStr(flag->kind.path->path.path, arena);
+        job->path.fd = -1;
+        output->path = job;
+    }
+    break;
+#endif // CLPARSE_PREFETCH
+
+    default:
+        break;
+    }
+}
+
+// copies every value into one allocation: the header, FlagKinds, main args
+// and then the arena for strings and list items
+static ClparseSnapshot* buildSnapshot(void) {
+    size_t flags_total = 0, args_total = 0, arena_size = 0;
+    ClparseSnapshot* snapshot;
+    char* arena;
+
+    for (size_t scope = 0; scope <= subcommands_len; ++scope) {
+        const Flag* flags = scope == 0 ? main_flags : subcommands[scope - 1].flags;
+        size_t flags_len = scope == 0 ? main_flags_len : subcommands[scope - 1].flags_len;
+        const MainArg* args = scope == 0 ? main_main_args : subcommands[scope - 1].main_args;
+        size_t args_len = scope == 0 ? main_args_len : subcommands[scope - 1].main_args_len;
+
+        for (size_t i = 0; i < flags_len; ++i) arena_size += snapshotFlagSize(&flags[i]);
+        for (size_t i = 0; i < args_len; ++i) {
+            if (args[i].value) {
+                arena_size += CLPARSE_ALIGN_UP(sizeof(cchar) * (cstrlen(args[i].value) + 1));
+            }
+        }
+        arena_size += snapshotSliceSize(scope == 0 ? &main_variadic_args
+                                                   : &subcommands[scope - 1].variadic_args);
+        flags_total += flags_len;
+        args_total += args_len;
+    }
+    arena_size += snapshotSliceSize(&passthrough_args);
+
+    snapshot = (ClparseSnapshot*)malloc(
+        CLPARSE_ALIGN_UP(sizeof(ClparseSnapshot)) +
+        CLPARSE_ALIGN_UP(sizeof(FlagKind) * flags_total) +
+        CLPARSE_ALIGN_UP(sizeof(const cchar*) * args_total) +
+        arena_size);
+    if (!snapshot) {
+        clparse_err = CLPARSE_INTERNAL_ERROR;
+        err_msg_detail = "clparsePublish (allocation)";
+        return NULL;
+    }
+
+    snapshot->next_retired = NULL;
+    snapshot->retired_epoch = 0;
+    snapshot->kinds = (FlagKind*)((char*)snapshot + CLPARSE_ALIGN_UP(sizeof(ClparseSnapshot)));
+    snapshot->args = (const cchar**)((char*)snapshot->kinds +
+                                     CLPARSE_ALIGN_UP(sizeof(FlagKind) * flags_total));
+    arena = (char*)snapshot->args + CLPARSE_ALIGN_UP(sizeof(const cchar*) * args_total);
+
+    flags_total = 0;
+    args_total = 0;
+    for (size_t scope = 0; scope <= subcommands_len; ++scope) {
+        const Flag* flags = scope == 0 ? main_flags : subcommands[scope - 1].flags;
+        size_t flags_len = scope == 0 ? main_flags_len : subcommands[scope - 1].flags_len;
+        const MainArg* args = scope == 0 ? main_main_args : subcommands[scope - 1].main_args;
+        size_t args_len = scope == 0 ? main_args_len : subcommands[scope - 1].main_args_len;
+
+        snapshot->flag_offsets[scope] = flags_total;
+        snapshot->arg_offsets[scope] = args_total;
+        for (size_t i = 0; i < flags_len; ++i) {
+            snapshotFlag(&flags[i], &snapshot->kinds[flags_total++], &arena);
+        }
+        for (size_t i = 0; i < args_len; ++i) {
+            snapshot->args[args_total++] = snapshotStr(args[i].value, &arena);
+        }
+        if (scope > 0) snapshot->activated[scope - 1] = subcommands[scope - 1].is_activate;
+        snapshotSlice(scope == 0 ? &main_variadic_args : &subcommands[scope - 1].variadic_args,
+                      &snapshot->variadics[scope], &arena);
+    }
+    snapshot->subcommands_len = subcommands_len;
+    snapshot->flag_offsets[subcommands_len + 1] = flags_total;
+    snapshot->arg_offsets[subcommands_len + 1] = args_total;
+#ifdef CLPARSE_PREFETCH
+    snapshot->path_jobs_len = path_jobs_len;
+    for (size_t i = 0; i < path_jobs_len; ++i) {
+        HandleKind kind;
+        size_t scope, idx;
+
+        resolveHandle(&path_jobs[i].flag->kind, &kind, &scope, &idx);
+        snapshot->path_slots[i] = snapshot->flag_offsets[scope] + idx;
+    }
+#endif // CLPARSE_PREFETCH
+    snapshotSlice(&passthrough_args, &snapshot->passthrough, &arena);
+
+    return snapshot;
+}
+
+// frees retired snapshots which no reader can see anymore. With is_all, every
+// snapshot is freed regardless of readers.
+static void reclaimSnapshots(bool is_all) {
+    uint64_t min_epoch = UINT64_MAX;
+    ClparseSnapshot** link = &retired_snapshots;
+
+    if (is_all) {
+        ClparseSnapshot* current = (ClparseSnapshot*)CLPARSE_ATOMIC_EXCHANGE_PTR(&current_snapshot, NULL);
+        free(current);
+    } else {
+        for (size_t i = 0; i < CLPARSE_READERS_CAPACITY; ++i) {
+            uint64_t epoch = CLPARSE_ATOMIC_LOAD_U64(&snapshot_readers[i].epoch);
+            if (epoch != 0 && epoch < min_epoch) min_epoch = epoch;
+        }
+    }
+
+    while (*link) {
+        ClparseSnapshot* snapshot = *link;
+        if (is_all || snapshot->retired_epoch < min_epoch) {
+            *link = snapshot->next_retired;
+            free(snapshot);
+        } else {
+            link = &snapshot->next_retired;
+        }
+    }
+}
+
+#endif // CLPARSE_SNAPSHOT
+
+void* clparseSerialize(size_t* size) {
+    size_t block_size;
+    char* block;
+
+    // the layout has to be the same in every process
+    if (!buildAllSubcmds()) return NULL;
+    block_size = writeBlock(NULL);
+    block = (char*)calloc(1, block_size);
+
+    if (!block) {
+        clparse_err = CLPARSE_INTERNAL_ERROR;
+        err_msg_detail = "clparseSerialize (allocation)";
+        return NULL;
+    }
+
+    writeBlock(block);
+    if (size) *size = block_size;
+    return block;
+}
+
+bool clparseAttach(const void* block, size_t size) {
+    size_t ptrs_len = 0;
+    cchar** ptrs;
+    cchar** old_ptrs = attached_ptrs;
+
+    if (!buildAllSubcmds()) return false;
+
+    // checks everything first, so that nothing changes on failure
+    if (!attachBlock((const char*)block, size, NULL, &ptrs_len)) {
+        clparse_err = CLPARSE_ERR_KIND_INVALID_BLOCK;
+        return false;
+    }
+
+    ptrs = (cchar**)malloc(sizeof(cchar*) * (ptrs_len ? ptrs_len : 1));
+    if (!ptrs) {
+        clparse_err = CLPARSE_INTERNAL_ERROR;
+        err_msg_detail = "clparseAttach (allocation)";
+        return false;
+    }
+
+    ptrs_len = 0;
+    attachBlock((const char*)block, size, ptrs, &ptrs_len);
+    free(old_ptrs);
+    attached_block = (const char*)block;
+    attached_size = size;
+    attached_ptrs = ptrs;
+    attached_ptrs_len = ptrs_len;
+    clparse_err = CLPARSE_ERR_KIND_OK;
+    computeFingerprint();
+
+    return true;
+}
+
+static bool isAttached(const void* ptr) {
+    const char* bytes = (const char*)ptr;
+
+    if (!bytes) return false;
+    if (attached_block && bytes >= attached_block && bytes < attached_block + attached_size) {
+        return true;
+    }
+    return attached_ptrs && bytes >= (const char*)attached_ptrs &&
+           bytes < (const char*)(attached_ptrs + attached_ptrs_len);
+}
+
+// variadic arguments are owned by clparse unless they are read from a block
+static void freeArgvSlice(ArgvSlice* slice) {
+    if (!isAttached(slice->items)) free(slice->items);
+    slice->items = NULL;
+    slice->len = 0;
+}
+
+static size_t listItemSize(ArrayListKind kind) {
+    switch (kind) {
+#define T(_name, _type, _foo1, _foo2, _array_list_type)                        \
+    case _array_list_type:                                                     \
+        return sizeof(_type);
+
+    CLPARSE_TYPES(T)
+#undef T
+    }
+    return 0;
+}
+
+static size_t scalarSize(FlagType type) {
+    switch (type) {
+#define T(_name, _type, _foo1, _flag_type, _foo2)                              \
+    case _flag_type:                                                           \
+        return sizeof(_type);
+
+    CLPARSE_TYPES(T)
+#undef T
+    default:
+        return 0;
+    }
+}
+
+static size_t blockReserve(size_t* pos, size_t size) {
+    size_t offset = *pos;
+    *pos += CLPARSE_ALIGN_UP(size);
+    return offset;
+}
+
+// With a NULL block, these only count the size
+static uint64_t blockAppend(char* block, size_t* pos, const void* data, size_t size) {
+    size_t offset = blockReserve(pos, size);
+    if (block && size) memcpy(block + offset, data, size);
+    return offset;
+}
+
+static uint64_t blockAppendStr(char* block, size_t* pos, const cchar* str) {
+    if (!str) return 0;
+    return blockAppend(block, pos, str, sizeof(cchar) * (cstrlen(str) + 1));
+}
+
+static uint64_t blockAppendStrs(char* block, size_t* pos, cchar* const* strs, size_t len) {
+    size_t offset = blockReserve(pos, sizeof(uint64_t) * len);
+
+    for (size_t i = 0; i < len; ++i) {
+        uint64_t str_offset = blockAppendStr(block, pos, strs[i]);
+        if (block) memcpy(block + offset + sizeof(uint64_t) * i, &str_offset, sizeof(uint64_t));
+    }
+    return offset;
+}
+
+static void writeBlockFlag(char* block, size_t* pos, const Flag* flag, size_t record_offset) {
+    BlockFlag record;
+
+    memset(&record, 0, sizeof(BlockFlag));
+    record.type = (uint32_t)flag->type;
+
+    switch (flag->type) {
+    case FLAG_TYPE_STRING:
+        record.offset = blockAppendStr(block, pos, flag->kind.str);
+        break;
+
+    case FLAG_TYPE_LIST:
+        record.list_kind = (uint32_t)flag->kind.lst.kind;
+        record.len = flag->kind.lst.len;
+        if (flag->kind.lst.kind == ARRAY_LIST_STRING) {
+            record.offset = blockAppendStrs(block, pos, (cchar* const*)flag->kind.lst.items,
+                                            flag->kind.lst.len);
+        } else {
+            record.offset = blockAppend(block, pos, flag->kind.lst.items,
+                                        listItemSize(flag->kind.lst.kind) * flag->kind.lst.len);
+        }
+        break;
+
+    case FLAG_TYPE_RANGE:
+        record.len = flag->kind.rng.len;
+        record.offset = blockAppend(block, pos, flag->kind.rng.items,
+                                    sizeof(RangeInterval) * flag->kind.rng.len);
+        blockAppend(block, pos, flag->kind.rng.ends, sizeof(uint64_t) * flag->kind.rng.len);
+        break;
+
+    case FLAG_TYPE_CHOICE:
+        record.scalar = flag->kind.choice.index;
+        break;
+
+#ifdef CLPARSE_PREFETCH
+    case FLAG_TYPE_PATH:
+        record.offset = blockAppendStr(block, pos, flag->kind.path->path.path);
+        break;
+#endif // CLPARSE_PREFETCH
+
+    default:
+        // every other FlagKind member is a scalar at offset 0
+        memcpy(&record.scalar, &flag->kind, scalarSize(flag->type));
+        break;
+    }
+
+    if (block) memcpy(block + record_offset, &record, sizeof(BlockFlag));
+}
+
+// writes the block and returns its size. With a NULL block, it only counts it.
+static size_t writeBlock(char* block) {
+    BlockHeader header;
+    size_t pos = 0;
+
+    memset(&header, 0, sizeof(BlockHeader));
+    blockReserve(&pos, sizeof(BlockHeader));
+    header.scopes_len = (uint32_t)(subcommands_len + 1);
+    header.scopes_offset = blockReserve(&pos, sizeof(BlockScope) * header.scopes_len);
+
+    for (size_t scope = 0; scope <= subcommands_len; ++scope) {
+        const Flag* flags = scope == 0 ? main_flags : subcommands[scope - 1].flags;
+        size_t flags_len = scope == 0 ? main_flags_len : subcommands[scope - 1].flags_len;
+        const MainArg* args = scope == 0 ? main_main_args : subcommands[scope - 1].main_args;
+        size_t args_len = scope == 0 ? main_args_len : subcommands[scope - 1].main_args_len;
+        const ArgvSlice* variadic = scope == 0 ? &main_variadic_args
+                                               : &subcommands[scope - 1].variadic_args;
+        BlockScope record;
+
+        memset(&record, 0, sizeof(BlockScope));
+        record.flags_len = (uint32_t)flags_len;
+        record.args_len = (uint32_t)args_len;
+        record.is_activate = scope > 0 && subcommands[scope - 1].is_activate;
+        record.flags_offset = blockReserve(&pos, sizeof(BlockFlag) * flags_len);
+        record.args_offset = blockReserve(&pos, sizeof(uint64_t) * args_len);
+
+        for (size_t i = 0; i < flags_len; ++i) {
+            writeBlockFlag(block, &pos, &flags[i], record.flags_offset + sizeof(BlockFlag) * i);
+        }
+        for (size_t i = 0; i < args_len; ++i) {
+            uint64_t offset = blockAppendStr(block, &pos, args[i].value);
+            if (block) {
+                memcpy(block + record.args_offset + sizeof(uint64_t) * i, &offset, sizeof(uint64_t));
+            }
+        }
+        record.variadic_len = variadic->len;
+        record.variadic_offset = blockAppendStrs(block, &pos, variadic->items, variadic->len);
+
+        if (block) {
+            memcpy(block + header.scopes_offset + sizeof(BlockScope) * scope, &record,
+                   sizeof(BlockScope));
+        }
+    }
+
+    header.passthrough_len = passthrough_args.len;
+    header.passthrough_offset = blockAppendStrs(block, &pos, passthrough_args.items,
+                                                passthrough_args.len);
+
+    header.magic = CLPARSE_BLOCK_MAGIC;
+    header.version = CLPARSE_BLOCK_VERSION;
+    header.size = pos;
+    header.cchar_size = (uint16_t)sizeof(cchar);
+    header.pointer_size = (uint16_t)sizeof(void*);
+    if (block) memcpy(block, &header, sizeof(BlockHeader));
+
+    return pos;
+}
+
+static bool blockFits(size_t size, uint64_t offset, uint64_t len, size_t item_size) {
+    return offset % 8 == 0 && offset <= size && len <= (size - offset) / item_size;
+}
+
+// checks that a NUL terminated string is at offset, where 0 stands for NULL
+static bool blockStrFits(const char* block, size_t size, uint64_t offset) {
+    if (offset == 0) return true;
+    if (offset >= size || offset % sizeof(cchar) != 0) return false;
+    return cmemchr((const cchar*)(block + offset), 0, (size_t)(size - offset) / sizeof(cchar)) != NULL;
+}
+
+// checks that intervals are valid, sorted and disjoint, and that `ends` counts
+// them as normalizeRanges does, so that queries stay in their intervals
+static bool blockRangesFit(const char* block, size_t size, const BlockFlag* record) {
+    const RangeInterval* items;
+    const uint64_t* ends;
+
+    if (!blockFits(size, record->offset, record->len, sizeof(RangeInterval) + sizeof(uint64_t))) {
+        return false;
+    }
+    items = (const RangeInterval*)(block + record->offset);
+    ends = (const uint64_t*)(items + record->len);
+
+    for (size_t i = 0; i < record->len; ++i) {
+        const RangeInterval* interval = &items[i];
+        uint64_t prev = i > 0 ? ends[i - 1] : 0;
+        uint64_t count;
+
+        if (interval->step == 0 || interval->lo > interval->hi ||
+                (interval->hi - interval->lo) % interval->step != 0) {
+            return false;
+        }
+        if (i > 0 && interval->lo <= items[i - 1].hi) return false;
+
+        count = (interval->hi - interval->lo) / interval->step;
+        count = count == UINT64_MAX ? UINT64_MAX : count + 1;
+        if (ends[i] != (count > UINT64_MAX - prev ? UINT64_MAX : prev + count)) return false;
+    }
+    return true;
+}
+
+// checks a string array, or points `ptrs` into the block when ptrs is given
+static bool attachStrs(const char* block, size_t size, uint64_t offset, uint64_t len,
+                       cchar** ptrs, size_t* ptrs_len, cchar*** output) {
+    const uint64_t* offsets;
+
+    if (!ptrs) {
+        if (!blockFits(size, offset, len, sizeof(uint64_t))) return false;
+        offsets = (const uint64_t*)(block + offset);
+        for (size_t i = 0; i < len; ++i) {
+            if (offsets[i] == 0 || !blockStrFits(block, size, offsets[i])) return false;
+        }
+        *ptrs_len += len;
+        return true;
+    }
+
+    offsets = (const uint64_t*)(block + offset);
+    *output = len ? ptrs + *ptrs_len : NULL;
+    for (size_t i = 0; i < len; ++i) {
+        ptrs[(*ptrs_len)++] = (cchar*)(block + offsets[i]);
+    }
+    return true;
+}
+
+static bool attachFlag(const char* block, size_t size, const BlockFlag* record, Flag* flag,
+                       cchar** ptrs, size_t* ptrs_len) {
+    if (!ptrs) {
+        if (record->type != (uint32_t)flag->type) return false;
+        switch (flag->type) {
+        case FLAG_TYPE_BOOL:
+            // any other byte is not a valid bool
+            return *(const unsigned char*)&record->scalar <= 1;
+        case FLAG_TYPE_STRING:
+            return blockStrFits(block, size, record->offset);
+        case FLAG_TYPE_LIST:
+            if (record->list_kind != (uint32_t)flag->kind.lst.kind) return false;
+            if (flag->kind.lst.kind == ARRAY_LIST_STRING) {
+                return attachStrs(block, size, record->offset, record->len, NULL, ptrs_len, NULL);
+            }
+            return blockFits(size, record->offset, record->len, listItemSize(flag->kind.lst.kind));
+        case FLAG_TYPE_RANGE:
+            return blockRangesFit(block, size, record);
+        case FLAG_TYPE_CHOICE:
+            return flag->kind.choice.table && record->scalar < flag->kind.choice.table->len;
+#ifdef CLPARSE_PREFETCH
+        case FLAG_TYPE_PATH:
+            return blockStrFits(block, size, record->offset);
+#endif // CLPARSE_PREFETCH
+        default:
+            return true;
+        }
+    }
+
+    switch (flag->type) {
+    case FLAG_TYPE_STRING:
+        flag->kind.str = record->offset ? (const cchar*)(block + record->offset) : NULL;
+        break;
+
+    case FLAG_TYPE_LIST:
+        deinitFlag(flag);
+        flag->kind.lst.len = (size_t)record->len;
+        if (flag->kind.lst.kind == ARRAY_LIST_STRING) {
+            cchar** items;
+            attachStrs(block, size, record->offset, record->len, ptrs, ptrs_len, &items);
+            flag->kind.lst.items = (void*)items;
+        } else {
+            flag->kind.lst.items = record->len ? (void*)(block + record->offset) : NULL;
+        }
+        break;
+
+    case FLAG_TYPE_RANGE:
+        deinitFlag(flag);
+        flag->kind.rng.len = (size_t)record->len;
+        if (record->len) {
+            flag->kind.rng.items = (RangeInterval*)(block + record->offset);
+            flag->kind.rng.ends = (uint64_t*)(flag->kind.rng.items + record->len);
+        }
+        break;
+
+    case FLAG_TYPE_CHOICE:
+        flag->kind.choice.index = (size_t)record->scalar;
+        break;
+
+#ifdef CLPARSE_PREFETCH
+    case FLAG_TYPE_PATH:
+        // workers prefetch their files too
+        startPathJob(flag->kind.path,
+                     record->offset ? (const cchar*)(block + record->offset) : NULL);
+        break;
+#endif // CLPARSE_PREFETCH
+
+    default:
+        memcpy(&flag->kind, &record->scalar, scalarSize(flag->type));
+        break;
+    }
+
+    return true;
+}
+
+// With a NULL ptrs, it only checks the block and counts the pointers to rebuild.
+// Otherwise, the block must have been checked already.
+static bool attachBlock(const char* block, size_t size, cchar** ptrs, size_t* ptrs_len) {
+    const BlockHeader* header = (const BlockHeader*)block;
+    const BlockScope* scopes;
+
+    if (!block || size < sizeof(BlockHeader) || (uintptr_t)block % 8 != 0) return false;
+    if (header->magic != CLPARSE_BLOCK_MAGIC || header->version != CLPARSE_BLOCK_VERSION ||
+        header->size != size || header->cchar_size != sizeof(cchar) ||
+        header->pointer_size != sizeof(void*) || header->scopes_len != subcommands_len + 1 ||
+        !blockFits(size, header->scopes_offset, header->scopes_len, sizeof(BlockScope))) {
+        return false;
+    }
+    scopes = (const BlockScope*)(block + header->scopes_offset);
+
+    if (ptrs) activated_subcmd = NULL;
+    for (size_t scope = 0; scope <= subcommands_len; ++scope) {
+        const BlockScope* record = &scopes[scope];
+        Flag* flags = scope == 0 ? main_flags : subcommands[scope - 1].flags;
+        size_t flags_len = scope == 0 ? main_flags_len : subcommands[scope - 1].flags_len;
+        MainArg* args = scope == 0 ? main_main_args : subcommands[scope - 1].main_args;
+        size_t args_len = scope == 0 ? main_args_len : subcommands[scope - 1].main_args_len;
+        ArgvSlice* variadic = scope == 0 ? &main_variadic_args
+                                         : &subcommands[scope - 1].variadic_args;
+        const BlockFlag* flag_records;
+        const uint64_t* arg_offsets;
+
+        if (!ptrs && (record->flags_len != flags_len || record->args_len != args_len ||
+                      !blockFits(size, record->flags_offset, flags_len, sizeof(BlockFlag)) ||
+                      !blockFits(size, record->args_offset, args_len, sizeof(uint64_t)))) {
+            return false;
+        }
+        flag_records = (const BlockFlag*)(block + record->flags_offset);
+        arg_offsets = (const uint64_t*)(block + record->args_offset);
+
+        for (size_t i = 0; i < flags_len; ++i) {
+            if (!attachFlag(block, size, &flag_records[i], &flags[i], ptrs, ptrs_len)) {
+                return false;
+            }
+        }
+        for (size_t i = 0; i < args_len; ++i) {
+            if (!ptrs) {
+                if (!blockStrFits(block, size, arg_offsets[i])) return false;
+            } else {
+                args[i].value = arg_offsets[i] ? (const cchar*)(block + arg_offsets[i]) : NULL;
+            }
+        }
+        if (ptrs) freeArgvSlice(variadic);
+        if (!attachStrs(block, size, record->variadic_offset, record->variadic_len, ptrs,
+                        ptrs_len, &variadic->items)) {
+            return false;
+        }
+        if (ptrs) variadic->len = (size_t)record->variadic_len;
+
+        if (ptrs && scope > 0) {
+            subcommands[scope - 1].is_activate = record->is_activate != 0;
+            if (record->is_activate) activated_subcmd = &subcommands[scope - 1];
+        }
+    }
+
+    if (!attachStrs(block, size, header->passthrough_offset, header->passthrough_len, ptrs,
+                    ptrs_len, &passthrough_args.items)) {
+        return false;
+    }
+    if (ptrs) passthrough_args.len = (size_t)header->passthrough_len;
+
+    return true;
+}
+
+#ifdef CLPARSE_TRACE
+void clparseTraceTo(int fd) {
+    struct stat st;
+
+    trace_fd = fd;
+    if (fd < 0) return;
+
+    // the events are appended to the array which the sink has already
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ? st.st_size > 0 : fd == trace_header_fd) {
+        return;
+    }
+    trace_header_fd = fd;
+    if (write(fd, "[\n", 2) < 0) trace_fd = -1;
+}
+
+// Writes at most 64 characters of `str` as the body of a JSON string. A UTF-8
+// sequence is never cut in the middle.
+static void traceEscape(char* output, const cchar* str) {
+    static const char hex[] = "0123456789abcdef";
+    size_t i, len = 0;
+
+    while (len < 64 && str[len]) ++len;
+    if (sizeof(cchar) == 1 && len == 64) {
+        // backs up to the lead byte of the sequence which does not fit
+        while (len > 0 && ((unsigned char)str[len] & 0xC0) == 0x80) --len;
+    }
+
+    for (i = 0; i < len; ++i) {
+        long ch = (long)str[i];
+        if (sizeof(cchar) == 1) ch &= 0xFF;
+
+        if (ch == '"' || ch == '\\') {
+            *output++ = '\\';
+            *output++ = (char)ch;
+        } else if (ch < 0x20 || (sizeof(cchar) > 1 && ch >= 0x7F)) {
+            if (ch > 0xFFFF) ch = 0xFFFD;
+            *output++ = '\\';
+            *output++ = 'u';
+            *output++ = hex[(ch >> 12) & 0xF];
+            *output++ = hex[(ch >> 8) & 0xF];
+            *output++ = hex[(ch >> 4) & 0xF];
+            *output++ = hex[ch & 0xF];
+        } else {
+            *output++ = (char)ch;
+        }
+    }
+    *output = '\0';
+}
+
+// `name` is always one of the literals of the CLPARSE_TRACE_* macros
+static void traceEvent(const char* name, char phase, const cchar* subject, long long value) {
+    char buf[512];
+    char escaped[64 * 6 + 1];
+    long long ts;
+    int len;
+
+#if defined(CLOCK_MONOTONIC) || defined(TIME_UTC)
+    struct timespec now;
+#   ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#   else
+    timespec_get(&now, TIME_UTC);
+#   endif // CLOCK_MONOTONIC
+    ts = (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#else
+    ts = (long long)(clock() / (CLOCKS_PER_SEC / 1000000.0));
+#endif // CLOCK_MONOTONIC || TIME_UTC
+
+    if (subject) {
+        traceEscape(escaped, subject);
+        len = snprintf(buf, sizeof(buf),
+                       "{\"name\":\"%s\",\"cat\":\"clparse\",\"ph\":\"%c\",\"ts\":%lld,"
+                       "\"pid\":%d,\"tid\":0,\"s\":\"t\",\"args\":{\"name\":\"%s\","
+                       "\"value\":%lld}},\n",
+                       name, phase, ts, (int)getpid(), escaped, value);
+    } else {
+        len = snprintf(buf, sizeof(buf),
+                       "{\"name\":\"%s\",\"cat\":\"clparse\",\"ph\":\"%c\",\"ts\":%lld,"
+                       "\"pid\":%d,\"tid\":0,\"args\":{\"value\":%lld}},\n",
+                       name, phase, ts, (int)getpid(), value);
+    }
+
+    if (len > 0 && (size_t)len < sizeof(buf) && write(trace_fd, buf, (size_t)len) < 0) {
+        trace_fd = -1;
+    }
+}
+#endif // CLPARSE_TRACE
+
+void clparseSetLimits(const ClparseLimits* new_limits) {
+    if (new_limits) {
+        limits = *new_limits;
+    } else {
+        memset(&limits, 0, sizeof(ClparseLimits));
+    }
+}
+
+void clparseFingerprint(uint64_t output[2]) {
+    output[0] = fingerprint[0];
+    output[1] = fingerprint[1];
+}
+
+bool clparseFingerprintExclude(const void* handle) {
+    HandleKind kind;
+    size_t scope, idx;
+
+    if (!resolveHandle(handle, &kind, &scope, &idx) || kind != HANDLE_FLAG) return false;
+    if (scope == 0) {
+        main_flags[idx].is_uncached = true;
+    } else {
+        subcommands[scope - 1].flags[idx].is_uncached = true;
+    }
+    return true;
+}
+
+#define CLPARSE_ROTL64(_x, _r) (((_x) << (_r)) | ((_x) >> (64 - (_r))))
+
+static void fingerprintWord(uint64_t state[2], uint64_t word) {
+    state[0] = (state[0] ^ word) * 0x9e3779b97f4a7c15ULL;
+    state[0] ^= state[0] >> 32;
+    state[1] = CLPARSE_ROTL64(state[1] + word, 31) * 0xc2b2ae3d27d4eb4fULL;
+}
+
+// the caller hashes the size first, so the zero padding is not ambiguous
+static void fingerprintBytes(uint64_t state[2], const void* data, size_t size) {
+    const char* bytes = (const char*)data;
+    uint64_t word;
+
+    for (; size >= 8; bytes += 8, size -= 8) {
+        memcpy(&word, bytes, 8);
+        fingerprintWord(state, word);
+    }
+    if (size > 0) {
+        word = 0;
+        memcpy(&word, bytes, size);
+        fingerprintWord(state, word);
+    }
+}
+
+static void fingerprintStr(uint64_t state[2], const cchar* str) {
+    size_t len;
+
+    if (!str) {
+        fingerprintWord(state, UINT64_MAX);
+        return;
+    }
+    len = cstrlen(str);
+    fingerprintWord(state, len);
+    fingerprintBytes(state, str, sizeof(cchar) * len);
+}
+
+static void fingerprintSlice(uint64_t state[2], const ArgvSlice* slice) {
+    fingerprintWord(state, slice->len);
+    for (size_t i = 0; i < slice->len; ++i) fingerprintStr(state, slice->items[i]);
+}
+
+static void fingerprintFlag(uint64_t state[2], const Flag* flag) {
+    fingerprintStr(state, flag->name);
+    fingerprintWord(state, (uint64_t)flag->type);
+
+    switch (flag->type) {
+    case FLAG_TYPE_STRING:
+        fingerprintStr(state, flag->kind.str);
+        break;
+
+    case FLAG_TYPE_LIST:
+        fingerprintWord(state, flag->kind.lst.len);
+        if (flag->kind.lst.kind == ARRAY_LIST_STRING) {
+            for (size_t i = 0; i < flag->kind.lst.len; ++i) {
+                fingerprintStr(state, ((const cchar**)flag->kind.lst.items)[i]);
+            }
+        } else {
+            fingerprintBytes(state, flag->kind.lst.items,
+                             listItemSize(flag->kind.lst.kind) * flag->kind.lst.len);
+        }
+        break;
+
+    case FLAG_TYPE_RANGE:
+        // ranges are normalized, so `1,2,3` and `1-3` are the same
+        fingerprintWord(state, flag->kind.rng.len);
+        fingerprintBytes(state, flag->kind.rng.items, sizeof(RangeInterval) * flag->kind.rng.len);
+        break;
+
+    case FLAG_TYPE_CHOICE:
+        fingerprintStr(state, flag->kind.choice.table->choices[flag->kind.choice.index]);
+        break;
+
+#ifdef CLPARSE_PREFETCH
+    case FLAG_TYPE_PATH:
+        fingerprintStr(state, flag->kind.path->path.path);
+        break;
+#endif // CLPARSE_PREFETCH
+
+    default: {
+        uint64_t word = 0;
+        memcpy(&word, &flag->kind, scalarSize(flag->type));
+        fingerprintWord(state, word);
+    }
+    break;
+    }
+}
+
+static uint64_t fingerprintFinalize(uint64_t word) {
+    word ^= word >> 33;
+    word *= 0xff51afd7ed558ccdULL;
+    word ^= word >> 33;
+    word *= 0xc4ceb9fe1a85ec53ULL;
+    word ^= word >> 33;
+    return word;
+}
+
+// hashes the main command and the activated subcommand in registration order
+static void computeFingerprint(void) {
+    uint64_t state[2] = { 0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL };
+    size_t scopes[2] = { 0, 0 };
+    size_t scopes_len = 1;
+
+    if (activated_subcmd) {
+        scopes[scopes_len++] = (size_t)(activated_subcmd - subcommands) + 1;
+        fingerprintStr(state, activated_subcmd->name);
+    } else {
+        fingerprintStr(state, NULL);
+    }
+
+    for (size_t i = 0; i < scopes_len; ++i) {
+        size_t scope = scopes[i];
+        const Flag* flags = scope == 0 ? main_flags : subcommands[scope - 1].flags;
+        size_t flags_len = scope == 0 ? main_flags_len : subcommands[scope - 1].flags_len;
+        const MainArg* args = scope == 0 ? main_main_args : subcommands[scope - 1].main_args;
+        size_t args_len = scope == 0 ? main_args_len : subcommands[scope - 1].main_args_len;
+
+        for (size_t j = 0; j < flags_len; ++j) {
+            if (!flags[j].is_uncached) fingerprintFlag(state, &flags[j]);
+        }
+        for (size_t j = 0; j < args_len; ++j) fingerprintStr(state, args[j].value);
+        fingerprintSlice(state, scope == 0 ? &main_variadic_args
+                                           : &subcommands[scope - 1].variadic_args);
+    }
+    fingerprintSlice(state, &passthrough_args);
+
+    state[0] += state[1];
+    state[1] += state[0];
+    fingerprint[0] = fingerprintFinalize(state[0]);
+    fingerprint[1] = fingerprintFinalize(state[1]);
+    fingerprint[0] += fingerprint[1];
+    fingerprint[1] += fingerprint[0];
+}
+
+#undef CLPARSE_ROTL64
+
+// TODO: implement better and clean error printing message
+const char* clparseGetErr(void) {
+    switch (clparse_err) {
+    case CLPARSE_ERR_KIND_OK:
+        return NULL;
+
+    case CLPARSE_ERR_KIND_SUBCOMMAND_FIND:
+        return "Cannot find an appropriate subcommnads";
+
+    case CLPARSE_ERR_KIND_FLAG_FIND:
+        return "Cannot find an appropriate flag";
+
+    case CLPARSE_ERR_KIND_MAIN_ARGS_NUM_OVERFLOWED:
+        return "Too many main arguments are given";
+
+    case CLPARSE_ERR_KIND_INAVLID_NUMBER:
+        if (!err_flag) return "Invalid number or overflowed number is given";
+        if (err_flag->type != FLAG_TYPE_LIST) {
+            if (!err_value) {
+                snprintf(internal_err_msg, 200, "A number is expected for `--%" CSTR_FMT "`",
+                         err_flag->name);
+            } else {
+                snprintf(internal_err_msg, 200,
+                         "Invalid number or overflowed number `%" CSTR_FMT "` is given to `--%"
+                         CSTR_FMT "`", err_value, err_flag->name);
+            }
+            internal_err_msg[200] = '\0';
+            return internal_err_msg;
+        }
+        snprintf(internal_err_msg, 200,
+                 "Invalid number or overflowed number is given at the item %zu of `--%" CSTR_FMT "`",
+                 err_index, err_flag->name);
+        internal_err_msg[200] = '\0';
+        return internal_err_msg;
+
+    case CLPARSE_ERR_KIND_LONG_FLAG_WITH_SHORT_FLAG:
+        return "Long flags must start with `--`, not `-`";
+
+    case CLPARSE_ERR_KIND_INVALID_RANGE:
+        return "Invalid range is given (expected `a`, `a-b` or `a-b:step` separated by commas)";
+
+    case CLPARSE_ERR_KIND_MISSING_VALUE:
+        return "A flag which takes a value is given without it";
+
+    case CLPARSE_ERR_KIND_INVALID_CHOICE: {
+        const ChoiceTable* table = err_flag->kind.choice.table;
+        int len = snprintf(internal_err_msg, 200,
+                           "Invalid value `%" CSTR_FMT "` for `--%" CSTR_FMT "` (expected one of ",
+                           err_value, err_flag->name);
+
+        for (size_t i = 0; i < table->len && len >= 0 && len < 200; ++i) {
+            len += snprintf(internal_err_msg + len, 200 - len, "%s%" CSTR_FMT,
+                            i > 0 ? "|" : "", table->choices[i]);
+        }
+        if (len >= 0 && len < 200) snprintf(internal_err_msg + len, 200 - len, ")");
+        internal_err_msg[200] = '\0';
+        return internal_err_msg;
+    }
+
+    case CLPARSE_ERR_KIND_INVALID_BLOCK:
+        return "The serialized block is broken or does not match the registered flags";
+
+    case CLPARSE_ERR_KIND_TOO_MANY_TOKENS:
+        return "Too many arguments are given";
+
+    case CLPARSE_ERR_KIND_TOO_MANY_LIST_ITEMS:
+        snprintf(internal_err_msg, 200, "Too many items are given to `--%" CSTR_FMT "`",
+                 err_flag->name);
+        internal_err_msg[200] = '\0';
+        return internal_err_msg;
+
+    case CLPARSE_ERR_KIND_TOO_MANY_LIST_OCCURRENCES:
+        snprintf(internal_err_msg, 200, "`--%" CSTR_FMT "` is given too many times",
+                 err_flag->name);
+        internal_err_msg[200] = '\0';
+        return internal_err_msg;
+
+    case CLPARSE_ERR_KIND_TOO_MANY_ALLOC_BYTES:
+        return "Arguments need more memory than allowed";
+
+    case CLPARSE_ERR_KIND_INVALID_CHOICES:
+        snprintf(internal_err_msg, 200, "Invalid choices for a choice flag (%s)", err_msg_detail);
+        internal_err_msg[200] = '\0';
+        return internal_err_msg;
+
+    case CLPARSE_ERR_KIND_CAPACITY_EXCEEDED:
+        return "Too many flags or subcommands are registered (raise FLAG_CAPACITY, "
+               "SUBCOMMAND_CAPACITY or PATH_FLAG_CAPACITY)";
+
+#ifdef CLPARSE_PREFETCH
+    case CLPARSE_ERR_KIND_INVALID_PATH:
+        snprintf(internal_err_msg, 200, "Invalid path `%s` for `--%s` (%s)",
+                 err_flag->kind.path->path.path, err_flag->name,
+                 strerror(err_flag->kind.path->path.err));
+        internal_err_msg[200] = '\0';
+        return internal_err_msg;
+#endif // CLPARSE_PREFETCH
+
+    case CLPARSE_ERR_KIND_INVALID_CONSTRAINT:
+        return "A constraint is given a flag of another scope or an unknown handle";
+
+    case CLPARSE_ERR_KIND_MISSING_REQUIRED_FLAG:
+        snprintf(internal_err_msg, 200, "`--%" CSTR_FMT "` is required", err_flag->name);
+        internal_err_msg[200] = '\0';
+        return internal_err_msg;
+
+    case CLPARSE_ERR_KIND_CONFLICTING_FLAGS:
+        snprintf(internal_err_msg, 200, "`--%" CSTR_FMT "` cannot be used with `--%" CSTR_FMT "`",
+                 err_flag->name, err_other_flag->name);
+        internal_err_msg[200] = '\0';
+        return internal_err_msg;
+
+    case CLPARSE_ERR_KIND_MISSING_DEPENDENCY:
+        snprintf(internal_err_msg, 200, "`--%" CSTR_FMT "` requires `--%" CSTR_FMT "`",
+                 err_flag->name, err_other_flag->name);
+        internal_err_msg[200] = '\0';
+        return internal_err_msg;
+
+    case CLPARSE_INTERNAL_ERROR:
+        snprintf(internal_err_msg, 200, "Internal error was found at %s",
+                 err_msg_detail);
+        internal_err_msg[200] = '\0';
+        return internal_err_msg;
+
+    default:
+        assert(false && "Unreatchable (clparseGetErr)");
+        return "";
+    }
+}
+
+#if defined(_WIN32) && !defined(NO_USE_WIDE_ARGV) && !defined(USE_UTF8_ARGV)
+bool clparseGetCmdlineW(int* argc, LPWSTR** argv) {
+    LPWSTR args = GetCommandLineW();
+    *argv = CommandLineToArgvW(args, argc);
+    return *argv != NULL;
+}
+
+void clparseFreeCmdlineW(const LPWSTR* argv) {
+    LocalFree((void*)argv);
+}
+#endif
+
+#if defined(_WIN32) && defined(USE_UTF8_ARGV)
+bool clparseGetCmdlineUtf8(int* argc, char*** argv) {
+    LPWSTR* wargv = CommandLineToArgvW(GetCommandLineW(), argc);
+    if (!wargv) return false;
+
+    *argv = clparseArgvToUtf8(*argc, (const uint16_t* const*)wargv);
+    LocalFree((void*)wargv);
+
+    // help messages are written in UTF-8 as well
+    SetConsoleOutputCP(CP_UTF8);
+    return *argv != NULL;
+}
+#endif
+
+char** clparseArgvToUtf8(int argc, const uint16_t* const* wargv) {
+    size_t total_len = 0;
+    char** argv;
+    char* bytes;
+
+    for (int i = 0; i < argc; ++i) {
+        total_len += transcodeUtf16(NULL, wargv[i]) + 1;
+    }
+
+    argv = (char**)malloc(sizeof(char*) * ((size_t)argc + 1) + total_len);
+    if (!argv) return NULL;
+
+    bytes = (char*)(argv + argc + 1);
+    for (int i = 0; i < argc; ++i) {
+        argv[i] = bytes;
+        bytes += transcodeUtf16(bytes, wargv[i]);
+        *bytes++ = '\0';
+    }
+    argv[argc] = NULL;
+
+    return argv;
+}
+
+void clparseFreeArgvUtf8(char** argv) {
+    free(argv);
+}
+
+#ifndef USE_WIDE_ARGV
+bool clparseComplete(int argc, char** argv, const CompletionTable* table) {
+    CompletionTable built = { NULL, 0 };
+    const char* scope = "";
+    const char* prefix;
+    size_t prefix_len, lo;
+    int word = 2;
+
+    if (argc < 2 || strcmp(argv[1], "__complete") != 0) return false;
+
+    // only the subcommand being completed is built, not every lazy one
+    if (!table) {
+        size_t pos;
+
+        if (argc > 3 && argv[2][0] != '-' && findSubcmdPosition(&pos, argv[2]) &&
+                !buildSubcmd(&subcommands[pos])) {
+            return true;
+        }
+        if (!buildCompletionTable(&built)) return true;
+        table = &built;
+    }
+
+    // the last word is the one being completed
+    prefix = argc > 2 ? argv[argc - 1] : "";
+    prefix_len = strlen(prefix);
+
+    // subcommands are the words of the main scope, so the table tells whether
+    // the first word is one of them without any registration
+    if (argc > 3 && argv[2][0] != '-') {
+        lo = lowerBoundCompletion(table, "", argv[2]);
+        if (lo < table->len && compareCompletionKey(&table->entries[lo], "", argv[2]) == 0) {
+            scope = argv[2];
+        }
+        ++word;
+    }
+
+    // nothing is offered where a flag expects its value (e.g. `build --jobs `)
+    if (argc - 2 >= word && argv[argc - 2][0] == '-') {
+        lo = lowerBoundCompletion(table, scope, argv[argc - 2]);
+        if (lo < table->len && table->entries[lo].has_value &&
+                compareCompletionKey(&table->entries[lo], scope, argv[argc - 2]) == 0) {
+            free((void*)built.entries);
+            return true;
+        }
+    }
+
+    lo = lowerBoundCompletion(table, scope, prefix);
+
+    for (; lo < table->len; ++lo) {
+        const CompletionEntry* entry = &table->entries[lo];
+        if (strcmp(entry->scope, scope) != 0 ||
+                strncmp(entry->word, prefix, prefix_len) != 0) {
+            break;
+        }
+        // subcommands can only be the first word
+        if (word < argc - 1 && entry->word[0] != '-') continue;
+        fputs(entry->word, stdout);
+        fputc('\n', stdout);
+    }
+
+    free((void*)built.entries);
+    return true;
+}
+
+bool clparsePrintCompletionScript(const char* shell, FILE* out) {
+    const char* name = main_prog_name ? main_prog_name : "";
+    char ident[256];
+    size_t i;
+
+    // anything else could end a word or be expanded by the shell
+    if (!name[0] || name[0] == '-') return false;
+    for (i = 0; name[i]; ++i) {
+        if (!isalnum((unsigned char)name[i]) && !strchr("._+-", name[i])) return false;
+    }
+
+    for (i = 0; name[i] && i < sizeof(ident) - 1; ++i) {
+        ident[i] = isalnum((unsigned char)name[i]) ? name[i] : '_';
+    }
+    ident[i] = '\0';
+
+    if (strcmp(shell, "bash") == 0) {
+        fprintf(out,
+            "_%s_complete() {\n"
+            "    local IFS=$'\\n'\n"
+            "    COMPREPLY=($(%s __complete \"${COMP_WORDS[@]:1:COMP_CWORD}\"))\n"
+            "}\n"
+            "complete -o default -F _%s_complete %s\n",
+            ident, name, ident, name);
+    } else if (strcmp(shell, "zsh") == 0) {
+        fprintf(out,
+            "#compdef %s\n"
+            "_%s() {\n"
+            "    local -a candidates\n"
+            "    candidates=(${(f)\"$(%s __complete \"${(@)words[2,CURRENT]}\")\"})\n"
+            "    compadd -a candidates\n"
+            "}\n"
+            "compdef _%s %s\n",
+            name, ident, name, ident, name);
+    } else if (strcmp(shell, "fish") == 0) {
+        fprintf(out,
+            "complete -c %s -f -a '(%s __complete (commandline -opc)[2..-1] (commandline -ct))'\n",
+            name, name);
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+bool clparseDumpCompletionTable(const char* ident, FILE* out) {
+    CompletionTable table;
+    if (!buildAllSubcmds() || !buildCompletionTable(&table)) return false;
+
+    fprintf(out, "static const CompletionEntry %s_entries[] = {\n", ident);
+    for (size_t i = 0; i < table.len; ++i) {
+        fputs("    { ", out);
+        dumpStringLiteral(table.entries[i].scope, out);
+        fputs(", ", out);
+        dumpStringLiteral(table.entries[i].word, out);
+        fprintf(out, ", %d },\n", table.entries[i].has_value ? 1 : 0);
+    }
+    fprintf(out, "};\n");
+    fprintf(out, "static const CompletionTable %s = { %s_entries, %zu };\n",
+            ident, ident, table.len);
+
+    free((void*)table.entries);
+    return true;
+}
+#endif // USE_WIDE_ARGV
+
+/************************************/
+/* Static Functions Implementations */
+/************************************/
+static MainArg* clparseGetMainArg(const cchar* subcmd) {
+    MainArg* main_arg;
+
+    if (subcmd) {
+        size_t pos;
+        if (!findSubcmdPosition(&pos, subcmd)) return NULL;
+        Subcmd* subcmd = &subcommands[pos];
+        if (subcmd->main_args_len >= MAIN_ARGS_CAPACITY) {
+            clparse_err = CLPARSE_ERR_KIND_MAIN_ARGS_NUM_OVERFLOWED;
+            return NULL;
+        }
+        main_arg = &subcmd->main_args[subcmd->main_args_len++];
+    }
+    else {
+        if (main_args_len >= MAIN_ARGS_CAPACITY) {
+            clparse_err = CLPARSE_ERR_KIND_MAIN_ARGS_NUM_OVERFLOWED;
+            return NULL;
+        }
+        main_arg = &main_main_args[main_args_len++];
+    }
+
+    return main_arg;
+}
+
+static void deinitFlag(Flag* flag) {
+    flag->occurrences = 0;
+    if (flag->type == FLAG_TYPE_LIST) {
+        if (!isAttached(flag->kind.lst.items)) free(flag->kind.lst.items);
+        flag->kind.lst.items = NULL;
+        flag->kind.lst.len = 0;
+        freeListCopies(flag);
+    } else if (flag->type == FLAG_TYPE_RANGE) {
+        if (!isAttached(flag->kind.rng.items)) {
+            free(flag->kind.rng.items);
+            free(flag->kind.rng.ends);
+        }
+        flag->kind.rng.items = NULL;
+        flag->kind.rng.ends = NULL;
+        flag->kind.rng.len = 0;
+    } else if (flag->type == FLAG_TYPE_CHOICE) {
+        free(flag->kind.choice.table);
+        flag->kind.choice.table = NULL;
+    }
+#ifdef CLPARSE_PREFETCH
+    else if (flag->type == FLAG_TYPE_PATH) {
+        joinPathJob(flag->kind.path);
+        if (flag->kind.path->path.fd >= 0) close(flag->kind.path->path.fd);
+        flag->kind.path = NULL;
+    }
+#endif // CLPARSE_PREFETCH
+}
+
+// puts the default value back, so that the flag can be parsed again
+static void resetFlag(Flag* flag) {
+    flag->occurrences = 0;
+    switch (flag->type) {
+    case FLAG_TYPE_LIST:
+    case FLAG_TYPE_RANGE:
+        deinitFlag(flag);
+        break;
+
+    case FLAG_TYPE_CHOICE:
+        flag->kind.choice.index = flag->dfault.choice.index;
+        break;
+
+#ifdef CLPARSE_PREFETCH
+    case FLAG_TYPE_PATH:
+        joinPathJob(flag->kind.path);
+        if (flag->kind.path->path.fd >= 0) close(flag->kind.path->path.fd);
+        flag->kind.path->path.path = NULL;
+        flag->kind.path->path.fd = -1;
+        flag->kind.path->path.err = 0;
+        break;
+#endif // CLPARSE_PREFETCH
+
+    default:
+        flag->kind = flag->dfault;
+        break;
+    }
+}
+
+// puts every flag, main argument and subcommand back to the state before parsing
+static void resetValues(void) {
+    for (size_t scope = 0; scope <= subcommands_len; ++scope) {
+        Flag* flags = scope == 0 ? main_flags : subcommands[scope - 1].flags;
+        size_t flags_len = scope == 0 ? main_flags_len : subcommands[scope - 1].flags_len;
+        MainArg* args = scope == 0 ? main_main_args : subcommands[scope - 1].main_args;
+        size_t args_len = scope == 0 ? main_args_len : subcommands[scope - 1].main_args_len;
+        ArgvSlice* variadic_args = scope == 0 ? &main_variadic_args
+                                              : &subcommands[scope - 1].variadic_args;
+
+        for (size_t i = 0; i < flags_len; ++i) resetFlag(&flags[i]);
+        for (size_t i = 0; i < args_len; ++i) args[i].value = NULL;
+        freeArgvSlice(variadic_args);
+        if (scope > 0) subcommands[scope - 1].is_activate = false;
+    }
+    passthrough_args.items = NULL;
+    passthrough_args.len = 0;
+    activated_subcmd = NULL;
+}
+
+// scope is 0 for the main command and `i + 1` for subcommands[i]
+static bool resolveHandle(const void* handle, HandleKind* kind, size_t* scope, size_t* idx) {
+    uintptr_t ptr = (uintptr_t)handle;
+    const Flag* flags = main_flags;
+    size_t flags_len = main_flags_len;
+    const MainArg* args = main_main_args;
+    size_t args_len = main_args_len;
+
+    *scope = 0;
+    *idx = 0;
+    if (handle == &passthrough_args) {
+        *kind = HANDLE_PASSTHROUGH;
+        return true;
+    }
+    if (handle == &main_variadic_args) {
+        *kind = HANDLE_VARIADIC;
+        return true;
+    }
+    if (ptr >= (uintptr_t)subcommands && ptr < (uintptr_t)(subcommands + subcommands_len)) {
+        size_t pos = (ptr - (uintptr_t)subcommands) / sizeof(Subcmd);
+        if (handle == &subcommands[pos].is_activate) {
+            *kind = HANDLE_SUBCMD;
+            *scope = pos + 1;
+            return true;
+        }
+        if (handle == &subcommands[pos].variadic_args) {
+            *kind = HANDLE_VARIADIC;
+            *scope = pos + 1;
+            return true;
+        }
+        flags = subcommands[pos].flags;
+        flags_len = subcommands[pos].flags_len;
+        args = subcommands[pos].main_args;
+        args_len = subcommands[pos].main_args_len;
+        *scope = pos + 1;
+    }
+
+    if (ptr >= (uintptr_t)flags && ptr < (uintptr_t)(flags + flags_len)) {
+        *idx = (ptr - (uintptr_t)flags) / sizeof(Flag);
+        *kind = HANDLE_FLAG;
+        return handle == &flags[*idx].kind;
+    }
+    if (ptr >= (uintptr_t)args && ptr < (uintptr_t)(args + args_len)) {
+        *idx = (ptr - (uintptr_t)args) / sizeof(MainArg);
+        *kind = HANDLE_MAIN_ARG;
+        return handle == &args[*idx].value;
+    }
+
+#ifdef CLPARSE_PREFETCH
+    // a path flag hands out its job, which points back to the flag
+    if (ptr >= (uintptr_t)path_jobs && ptr < (uintptr_t)(path_jobs + path_jobs_len)) {
+        const PathJob* job = &path_jobs[(ptr - (uintptr_t)path_jobs) / sizeof(PathJob)];
+        return handle == &job->path && resolveHandle(&job->flag->kind, kind, scope, idx);
+    }
+#endif // CLPARSE_PREFETCH
+
+    return false;
+}
+
+static Flag* clparseGetFlag(const cchar* subcmd) {
+    Flag* flag;
+
+    if (subcmd != NO_SUBCMD) {
+        size_t pos;
+        if (!findSubcmdPosition(&pos, subcmd)) return NULL;
+
+        size_t* idx = &subcommands[pos].flags_len;
+        if (*idx >= FLAG_CAPACITY) {
+            clparse_err = CLPARSE_ERR_KIND_CAPACITY_EXCEEDED;
+            return NULL;
+        }
+
+        flag = &subcommands[pos].flags[(*idx)++];
+    }
+    else {
+        if (main_flags_len >= FLAG_CAPACITY) {
+            clparse_err = CLPARSE_ERR_KIND_CAPACITY_EXCEEDED;
+            return NULL;
+        }
+        flag = &main_flags[main_flags_len++];
+    }
+
+    return flag;
+}
+
+static size_t clparseHash(const cchar* letter) {
+    uint32_t hash = 0x811c9dc5;
+    const uint32_t prime = 16777619;
+    while (*letter) {
+        hash = ((uint32_t)*letter++ ^ hash) * prime;
+    }
+    return hash ^ (hash >> 10) << 10;
+}
+
+static bool findSubcmdPosition(size_t* output, const cchar* subcmd_name) {
+    size_t hash = clparseHash(subcmd_name);
+    HashBox* hashbox = &hash_map[hash];
+
+    if (!hashbox->name) return false;
+
+    while (hashbox && cstrcmp(subcmd_name, hashbox->name) != 0) {
+        hashbox = hashbox->next;
+    }
+
+    if (!hashbox) return false;
+
+    *output = hashbox->where;
+    return true;
+}
+
+// Runs the builder of a lazy subcommand once. A registration error of the
+// builder fails the parse as the subcommand cannot be parsed without it, and
+// what it registered is incomplete, so every later use fails the same way.
+static bool buildSubcmd(Subcmd* subcmd) {
+    ClparseSubcmdBuilder builder = subcmd->builder;
+    ClparseErrKind err = clparse_err;
+
+    if (subcmd->build_err != CLPARSE_ERR_KIND_OK) {
+        clparse_err = subcmd->build_err;
+        err_msg_detail = subcmd->build_err_detail;
+        return false;
+    }
+    if (!builder) return true;
+    subcmd->builder = NULL;
+
+    clparse_err = CLPARSE_ERR_KIND_OK;
+    builder(subcmd->name, subcmd->builder_ctx);
+    if (clparse_err != CLPARSE_ERR_KIND_OK) {
+        subcmd->build_err = clparse_err;
+        subcmd->build_err_detail = err_msg_detail;
+        return false;
+    }
+
+    clparse_err = err;
+    return true;
+}
+
+static bool buildAllSubcmds(void) {
+    for (size_t i = 0; i < subcommands_len; ++i) {
+        if (!buildSubcmd(&subcommands[i])) return false;
+    }
+    return true;
+}
+
+// handle must be a flag which resolveHandle accepts
+static FlagConstraint* getFlagConstraint(const void* handle, size_t* scope, size_t* idx) {
+    HandleKind kind;
+    Flag* flag;
+    ScopeConstraints* constraints;
+
+    resolveHandle(handle, &kind, scope, idx);
+    flag = *scope == 0 ? &main_flags[*idx] : &subcommands[*scope - 1].flags[*idx];
+    constraints = *scope == 0 ? &main_constraints : &subcommands[*scope - 1].constraints;
+
+    if (!flag->constraint) {
+        flag->constraint = (FlagConstraint*)calloc(1, sizeof(FlagConstraint));
+        if (!flag->constraint) {
+            clparse_err = CLPARSE_INTERNAL_ERROR;
+            err_msg_detail = "getFlagConstraint (allocation)";
+            return NULL;
+        }
+        FLAG_MASK_SET(constraints->constrained, *idx);
+    }
+
+    return flag->constraint;
+}
+
+// Costs FLAG_MASK_WORDS operations for the required flags, and as many for each
+// given flag which has a constraint, however many constraints there are
+static bool checkConstraints(const Flag* flags, const ScopeConstraints* constraints) {
+    for (size_t i = 0; i < FLAG_MASK_WORDS; ++i) {
+        uint64_t missing = constraints->required.words[i] & ~seen_flags.words[i];
+        if (missing) {
+            clparse_err = CLPARSE_ERR_KIND_MISSING_REQUIRED_FLAG;
+            err_flag = &flags[i * 64 + lowestBit(missing)];
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < FLAG_MASK_WORDS; ++i) {
+        uint64_t given = constraints->constrained.words[i] & seen_flags.words[i];
+
+        for (; given; given &= given - 1) {
+            const Flag* flag = &flags[i * 64 + lowestBit(given)];
+
+            for (size_t j = 0; j < FLAG_MASK_WORDS; ++j) {
+                uint64_t conflicts = flag->constraint->conflicts.words[j] & seen_flags.words[j];
+                uint64_t missing = flag->constraint->dependencies.words[j] & ~seen_flags.words[j];
+
+                if (conflicts) {
+                    clparse_err = CLPARSE_ERR_KIND_CONFLICTING_FLAGS;
+                    err_flag = flag;
+                    err_other_flag = &flags[j * 64 + lowestBit(conflicts)];
+                    return false;
+                }
+                if (missing) {
+                    clparse_err = CLPARSE_ERR_KIND_MISSING_DEPENDENCY;
+                    err_flag = flag;
+                    err_other_flag = &flags[j * 64 + lowestBit(missing)];
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// word must not be 0
+static size_t lowestBit(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (size_t)__builtin_ctzll(word);
+#else
+    size_t idx = 0;
+    for (; !(word & 1); word >>= 1) ++idx;
+    return idx;
+#endif
+}
+
+static void freeNextHashBox(HashBox* hashbox) {
+    if (!hashbox) return;
+
+    HashBox* next = hashbox->next;
+    while (next) {
+        hashbox = next;
+        next = next->next;
+        free(hashbox);
+    }
+}
+
+// finds a flag matching `--name`, `--name=value`, `-n` or `-n=value`. The part
+// after `=` is handed out through inline_value without copying it.
+static Flag* findFlag(Flag* flags, size_t flags_len, cchar* token, size_t token_len,
+                      cchar** inline_value) {
+    if (token[1] == CSTR('-')) {
+        cchar* name = token + 2;
+        cchar* eq = (cchar*)cmemchr(name, CSTR('='), token_len - 2);
+        size_t name_len = eq ? (size_t)(eq - name) : token_len - 2;
+
+        // `--=x` must not match a flag without a long name
+        for (size_t i = 0; i < flags_len && name_len > 0; ++i) {
+            if (cstrncmp(name, flags[i].name, name_len) == 0 &&
+                    flags[i].name[name_len] == CSTR('\0')) {
+                if (eq) *inline_value = eq + 1;
+                return &flags[i];
+            }
+        }
+    } else {
+        if (token[1] != CSTR('\0') && token[2] != CSTR('\0') && token[2] != CSTR('=')) {
+            clparse_err = CLPARSE_ERR_KIND_LONG_FLAG_WITH_SHORT_FLAG;
+            return NULL;
+        }
+
+        for (size_t i = 0; i < flags_len; ++i) {
+            if (token[1] != NO_SHORT && token[1] == flags[i].short_name) {
+                if (token[2] == CSTR('=')) *inline_value = token + 3;
+                return &flags[i];
+            }
+        }
+    }
+
+    clparse_err = CLPARSE_ERR_KIND_FLAG_FIND;
+    return NULL;
+}
+
+static bool parseInteger(const cchar* str, cchar** end, uint64_t* output) {
+#ifdef CLPARSE_PARSE_INTEGER
+    return CLPARSE_PARSE_INTEGER(str, end, output);
+#else
+    errno = 0;
+    *output = cstrtoull(str, end, 0);
+    return *end != str && errno != ERANGE;
+#endif // CLPARSE_PARSE_INTEGER
+}
+
+static size_t countListItems(const cchar* value, size_t len) {
+    const cchar* end = value + len;
+    size_t count = 1;
+    while ((value = (const cchar*)cmemchr(value, CSTR(','), (size_t)(end - value))) != NULL) {
+        ++count;
+        ++value;
+    }
+    return count;
+}
+
+// classifies every token into token_tags. The per token work is one strlen,
+// which libc already vectorizes; the rest only looks at the first characters.
+// `=` of `--name=value` is left to findFlag, which has to look for it anyway.
+static bool classifyTokens(int argc, cchar** argv) {
+    if ((size_t)argc > tokens_capacity) {
+        uint8_t* tags = (uint8_t*)realloc(token_tags, sizeof(uint8_t) * argc);
+        size_t* lens;
+
+        if (tags) token_tags = tags;
+        lens = tags ? (size_t*)realloc(token_lens, sizeof(size_t) * argc) : NULL;
+        if (!lens) {
+            clparse_err = CLPARSE_INTERNAL_ERROR;
+            err_msg_detail = "clparseParse (token allocation)";
+            return false;
+        }
+        token_lens = lens;
+        tokens_capacity = (size_t)argc;
+    }
+
+    for (int i = 0; i < argc; ++i) {
+        token_lens[i] = cstrlen(argv[i]);
+        token_tags[i] = (uint8_t)classifyToken(argv[i]);
+    }
+    return true;
+}
+
+static TokenTag classifyToken(const cchar* token) {
+    if (token[0] == CSTR('@')) return TOKEN_AT_FILE;
+    if (token[0] != CSTR('-')) return TOKEN_POSITIONAL;
+    if (token[1] != CSTR('-')) return iscdigit(token[1]) ? TOKEN_NEGATIVE : TOKEN_SHORT;
+    if (token[2] == CSTR('\0')) return TOKEN_DASHDASH;
+    return TOKEN_LONG;
+}
+
+static bool isPositionalTag(uint8_t tag) {
+    return tag == TOKEN_POSITIONAL || tag == TOKEN_AT_FILE;
+}
+
+// negative numbers are values of numeric lists, not flags
+static bool isListTag(uint8_t tag, bool is_numeric) {
+    return isPositionalTag(tag) || (is_numeric && tag == TOKEN_NEGATIVE);
+}
+
+// counts `count * size` bytes against ClparseLimits.max_alloc_bytes
+static bool reserveAllocBytes(size_t count, size_t size) {
+    if (!limits.max_alloc_bytes) return true;
+    if (count > (limits.max_alloc_bytes - alloc_bytes) / size) {
+        clparse_err = CLPARSE_ERR_KIND_TOO_MANY_ALLOC_BYTES;
+        return false;
+    }
+    alloc_bytes += count * size;
+    return true;
+}
+
+// checks ClparseLimits before a list or a range flag with `len` items grows by
+// `count` items
+static bool checkListLimits(Flag* flag, size_t len, size_t count, size_t item_size) {
+    ++flag->occurrences;
+    if (limits.max_list_occurrences && flag->occurrences > limits.max_list_occurrences) {
+        clparse_err = CLPARSE_ERR_KIND_TOO_MANY_LIST_OCCURRENCES;
+        err_flag = flag;
+        return false;
+    }
+    if (limits.max_list_items &&
+            (count > SIZE_MAX - len || len + count > limits.max_list_items)) {
+        clparse_err = CLPARSE_ERR_KIND_TOO_MANY_LIST_ITEMS;
+        err_flag = flag;
+        return false;
+    }
+    return reserveAllocBytes(count, item_size);
+}
+
+#ifdef CLPARSE_PARALLEL
+// A chunk starts at the item `begin` of tokens[token], and converts `len` items
+// into items[offset..]. failed is the index of the first invalid item, or
+// SIZE_MAX.
+typedef struct {
+    cchar** tokens;
+    size_t token;
+    const cchar* begin;
+    size_t len;
+    void* items;
+    ArrayListKind kind;
+    size_t offset;
+    size_t failed;
+} ListChunk;
+
+static void* convertListChunk(void* arg) {
+    ListChunk* chunk = (ListChunk*)arg;
+    const cchar* token = chunk->begin;
+    size_t token_idx = chunk->token;
+
+    for (size_t i = chunk->offset; i < chunk->offset + chunk->len; ++i) {
+        uint64_t number;
+        cchar* end;
+
+        if (!parseInteger(token, &end, &number) || (*end != CSTR(',') && *end != CSTR('\0'))) {
+            chunk->failed = i;
+            return NULL;
+        }
+
+        switch (chunk->kind) {
+        case ARRAY_LIST_I8: ((int8_t*)chunk->items)[i] = (int8_t)number; break;
+        case ARRAY_LIST_I16: ((int16_t*)chunk->items)[i] = (int16_t)number; break;
+        case ARRAY_LIST_I32: ((int32_t*)chunk->items)[i] = (int32_t)number; break;
+        case ARRAY_LIST_I64: ((int64_t*)chunk->items)[i] = (int64_t)number; break;
+        case ARRAY_LIST_U8: ((uint8_t*)chunk->items)[i] = (uint8_t)number; break;
+        case ARRAY_LIST_U16: ((uint16_t*)chunk->items)[i] = (uint16_t)number; break;
+        case ARRAY_LIST_U32: ((uint32_t*)chunk->items)[i] = (uint32_t)number; break;
+        case ARRAY_LIST_U64: ((uint64_t*)chunk->items)[i] = (uint64_t)number; break;
+        default: break;
+        }
+
+        if (i + 1 < chunk->offset + chunk->len) {
+            token = *end == CSTR(',') ? end + 1 : chunk->tokens[++token_idx];
+        }
+    }
+
+    return NULL;
+}
+
+// converts `len` items of the tokens into flag->kind.lst.items[offset..], which
+// is already allocated. Chunk boundaries are found by counting commas, so every
+// chunk knows its exact output range and the first failing index is the same
+// as the serial conversion would report.
+static bool convertListParallel(Flag* flag, cchar** tokens, size_t offset, size_t len) {
+    ListChunk chunks[CLPARSE_PARALLEL_THREADS];
+    pthread_t threads[CLPARSE_PARALLEL_THREADS];
+    bool is_spawned[CLPARSE_PARALLEL_THREADS];
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t chunks_len = cpus > 0 && (size_t)cpus < CLPARSE_PARALLEL_THREADS
+                            ? (size_t)cpus : CLPARSE_PARALLEL_THREADS;
+    size_t token_idx = 0, token_items = 0, chunk_len = (len + chunks_len - 1) / chunks_len;
+    const cchar* token = tokens[0];
+    size_t failed = SIZE_MAX;
+
+    chunks_len = (len + chunk_len - 1) / chunk_len;
+
+    for (size_t i = 0; i < chunks_len; ++i) {
+        size_t skip = i == 0 ? 0 : chunk_len;
+
+        // moves `token` forward by `skip` items, whole tokens at a time
+        while (skip > 0) {
+            size_t remaining = token_items ? token_items
+                                           : countListItems(token, cstrlen(token));
+            if (skip < remaining) {
+                for (; skip > 0; --skip, --remaining) token = cstrchr(token, CSTR(',')) + 1;
+                token_items = remaining;
+                break;
+            }
+            skip -= remaining;
+            token = tokens[++token_idx];
+            token_items = 0;
+        }
+
+        chunks[i].tokens = tokens;
+        chunks[i].token = token_idx;
+        chunks[i].begin = token;
+        chunks[i].len = i + 1 < chunks_len ? chunk_len : len - chunk_len * i;
+        chunks[i].items = flag->kind.lst.items;
+        chunks[i].kind = flag->kind.lst.kind;
+        chunks[i].offset = offset + chunk_len * i;
+        chunks[i].failed = SIZE_MAX;
+    }
+
+    // the first chunk runs on this thread, and so does a chunk whose thread
+    // cannot be created
+    for (size_t i = 1; i < chunks_len; ++i) {
+        is_spawned[i] = pthread_create(&threads[i], NULL, convertListChunk, &chunks[i]) == 0;
+        if (!is_spawned[i]) convertListChunk(&chunks[i]);
+    }
+    convertListChunk(&chunks[0]);
+    for (size_t i = 1; i < chunks_len; ++i) {
+        if (is_spawned[i]) pthread_join(threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < chunks_len && failed == SIZE_MAX; ++i) failed = chunks[i].failed;
+    if (failed != SIZE_MAX) {
+        clparse_err = CLPARSE_ERR_KIND_INAVLID_NUMBER;
+        err_flag = flag;
+        err_index = failed;
+        free(flag->kind.lst.items);
+        flag->kind.lst.items = NULL;
+        flag->kind.lst.len = 0;
+        return false;
+    }
+
+    return true;
+}
+#endif // CLPARSE_PARALLEL
+
+// string needs not be null terminated at len (e.g. an item of `t,f`)
+static bool isTruthy(const cchar* string, size_t len) {
+    if (!string) return false;
+
+    switch (string[0]) {
+    case CSTR('t'):
+    case CSTR('T'):
+        if (len == 1) return true;
+        return len == 4 && cstrncmp(string + 1, CSTR("rue"), 3) == 0;
+
+    default:
+        return false;
+    }
+}
+
+// whether comma separated values give several items
+static bool isSplitList(const Flag* flag) {
+#ifdef CLPARSE_SPLIT_STRING_LISTS
+    (void)flag;
+    return true;
+#else
+    return flag->kind.lst.kind != ARRAY_LIST_STRING;
+#endif // CLPARSE_SPLIT_STRING_LISTS
+}
+
+// Copies of tokens live in a chain of blocks, each one a pointer to the next
+// followed by the string
+static cchar* copyListToken(Flag* flag, const cchar* token) {
+    size_t len = cstrlen(token) + 1;
+    void** block;
+
+    if (!reserveAllocBytes(len, sizeof(cchar))) return NULL;
+    block = (void**)malloc(sizeof(void*) + sizeof(cchar) * len);
+    if (!block) {
+        clparse_err = CLPARSE_INTERNAL_ERROR;
+        err_msg_detail = "clparseParse (list copy)";
+        return NULL;
+    }
+
+    *block = flag->copies;
+    flag->copies = block;
+    return (cchar*)memcpy(block + 1, token, sizeof(cchar) * len);
+}
+
+static void freeListCopies(Flag* flag) {
+    while (flag->copies) {
+        void** block = (void**)flag->copies;
+        flag->copies = *block;
+        free(block);
+    }
+}
+
+// parses `a`, `a-b` and `a-b:step` segments separated by commas, appends them
+// into rng and normalizes it again. rng is left as it was on failure.
+static bool appendRanges(RangeList* rng, const cchar* str) {
+    size_t count = 1, len = rng->len;
+    for (const cchar* ptr = str; *ptr; ++ptr) {
+        if (*ptr == CSTR(',')) ++count;
+    }
+
+    RangeInterval* items = (RangeInterval*)realloc(
+        rng->items, sizeof(RangeInterval) * (rng->len + count));
+    if (!items) return false;
+    rng->items = items;
+
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t lo, hi, step = 1;
+        cchar* end;
+
+        if (!iscdigit(*str)) return false;
+        errno = 0;
+        lo = hi = cstrtoull(str, &end, 0);
+        if (errno == ERANGE) return false;
+
+        if (*end == CSTR('-')) {
+            str = end + 1;
+            if (!iscdigit(*str)) return false;
+            hi = cstrtoull(str, &end, 0);
+            if (errno == ERANGE) return false;
+        }
+        if (*end == CSTR(':')) {
+            str = end + 1;
+            if (!iscdigit(*str)) return false;
+            step = cstrtoull(str, &end, 0);
+            if (errno == ERANGE || step == 0) return false;
+        }
+        if ((*end != CSTR(',') && *end != CSTR('\0')) || hi < lo) return false;
+
+        hi = lo + (hi - lo) / step * step;
+        items[len].lo = lo;
+        items[len].hi = hi;
+        items[len].step = lo == hi ? 1 : step;
+        ++len;
+
+        str = end + 1;
+    }
+
+    return normalizeRanges(rng, len);
+}
+
+#ifndef RANGE_SPLIT_CAPACITY
+#define RANGE_SPLIT_CAPACITY (1 << 20)
+#endif // RANGE_SPLIT_CAPACITY
+
+// Intervals which overlap each other are split into disjoint runs. Each run is
+// a part of one interval, and their number is bounded by RANGE_SPLIT_CAPACITY
+// so that a pathological union (e.g. two huge interleaved intervals with
+// coprime steps) fails instead of running for ages.
+typedef struct {
+    RangeInterval* items;
+    size_t len;
+    size_t capacity;
+    size_t runs;
+} RangeBuilder;
+
+// members of an interval inside the current segment
+typedef struct {
+    uint64_t next;
+    uint64_t last;
+    uint64_t step;
+    bool is_done;
+} RangeCursor;
+
+// appends a run which is after every run appended before, merging it into the
+// last interval when they make one progression
+static bool pushRange(RangeBuilder* builder, uint64_t lo, uint64_t hi, uint64_t step) {
+    RangeInterval* last = builder->len > 0 ? &builder->items[builder->len - 1] : NULL;
+
+    if (++builder->runs > RANGE_SPLIT_CAPACITY) return false;
+    if (lo == hi) step = 1;
+
+    if (last) {
+        if (last->step == step && lo - last->hi == step) {
+            last->hi = hi;
+            return true;
+        } else if (last->lo == last->hi && lo - last->hi == step) {
+            last->step = step;
+            last->hi = hi;
+            return true;
+        } else if (lo == hi && lo - last->hi == last->step) {
+            last->hi = hi;
+            return true;
+        } else if (last->lo == last->hi && lo == hi) {
+            last->step = lo - last->hi;
+            last->hi = hi;
+            return true;
+        }
+    }
+
+    if (builder->len == builder->capacity) {
+        size_t capacity = builder->capacity ? builder->capacity * 2 : 8;
+        RangeInterval* items = (RangeInterval*)realloc(
+            builder->items, sizeof(RangeInterval) * capacity);
+        if (!items) return false;
+        builder->items = items;
+        builder->capacity = capacity;
+    }
+
+    builder->items[builder->len].lo = lo;
+    builder->items[builder->len].hi = hi;
+    builder->items[builder->len].step = step;
+    ++builder->len;
+
+    return true;
+}
+
+static void skipRangeCursor(RangeCursor* cursor, uint64_t value) {
+    if (value >= cursor->last) cursor->is_done = true;
+    else cursor->next = value + cursor->step;
+}
+
+// appends the union of cursors, each time the longest run of the smallest
+// member which no other cursor interrupts
+static bool pushRangeRuns(RangeBuilder* builder, RangeCursor* cursors, size_t len) {
+    for (;;) {
+        size_t min = len;
+        uint64_t bound = UINT64_MAX, hi, x;
+
+        for (size_t i = 0; i < len; ++i) {
+            if (!cursors[i].is_done && (min == len || cursors[i].next < cursors[min].next)) {
+                min = i;
+            }
+        }
+        if (min == len) return true;
+        x = cursors[min].next;
+
+        for (size_t i = 0; i < len; ++i) {
+            if (i == min || cursors[i].is_done) continue;
+            if (cursors[i].next == x) skipRangeCursor(&cursors[i], x);
+            if (!cursors[i].is_done && cursors[i].next < bound) bound = cursors[i].next;
+        }
+
+        hi = cursors[min].last;
+        if (bound <= hi) hi = x + (bound - 1 - x) / cursors[min].step * cursors[min].step;
+        if (!pushRange(builder, x, hi, cursors[min].step)) return false;
+        skipRangeCursor(&cursors[min], hi);
+    }
+}
+
+#ifndef RANGE_PERIOD_CHECK
+#define RANGE_PERIOD_CHECK 4096
+#endif // RANGE_PERIOD_CHECK
+
+// Appends the union of the intervals in active, which all cover [p, q]. The
+// union is periodic there with the lcm of the steps, so when one period makes
+// a single progression (e.g. `0-1000000:2,1-1000001:2`), so does the segment.
+static bool pushRangeSegment(
+    RangeBuilder* builder,
+    const RangeInterval* active,
+    size_t active_len,
+    RangeCursor* cursors,
+    uint64_t p,
+    uint64_t q
+) {
+    size_t len = 0, cover = 0;
+    uint64_t period = 1, members = 0;
+
+    for (size_t i = 0; i < active_len; ++i) {
+        uint64_t step = active[i].step;
+        uint64_t rem = active[i].lo < p ? (p - active[i].lo) % step : 0;
+        uint64_t first;
+
+        if (step == 1) return pushRange(builder, p, q, 1);
+        if (rem && step - rem > q - p) continue;
+        first = rem ? p + (step - rem) : (active[i].lo > p ? active[i].lo : p);
+        if (first > q) continue;
+
+        cursors[len].next = first;
+        cursors[len].last = first + (q - first) / step * step;
+        cursors[len].step = step;
+        cursors[len].is_done = false;
+        if (len == 0 || step < cursors[cover].step) cover = len;
+        ++len;
+    }
+    if (len == 0) return true;
+
+    // one interval may contain every other
+    for (size_t i = 0; i < len; ++i) {
+        if (cursors[i].step % cursors[cover].step != 0 || cursors[i].next < cursors[cover].next ||
+                (cursors[i].next - cursors[cover].next) % cursors[cover].step != 0) {
+            break;
+        }
+        if (i + 1 == len) {
+            return pushRange(builder, cursors[cover].next, cursors[cover].last,
+                             cursors[cover].step);
+        }
+    }
+
+    for (size_t i = 0; i < len && period != 0; ++i) {
+        uint64_t a = period, b = cursors[i].step;
+        while (b) {
+            uint64_t tmp = a % b;
+            a = b;
+            b = tmp;
+        }
+        period = period / a > UINT64_MAX / cursors[i].step ? 0 : period / a * cursors[i].step;
+    }
+    for (size_t i = 0; i < len && period != 0 && members <= RANGE_PERIOD_CHECK; ++i) {
+        members += period / cursors[i].step;
+    }
+
+    if (period != 0 && members <= RANGE_PERIOD_CHECK && q - p >= period) {
+        RangeBuilder one = { NULL, 0, 0, 0 };
+        RangeCursor* head = cursors + len;
+        bool is_single;
+        uint64_t step = 0;
+
+        for (size_t i = 0; i < len; ++i) {
+            head[i] = cursors[i];
+            head[i].last = head[i].next +
+                           (p + (period - 1) - head[i].next) / head[i].step * head[i].step;
+        }
+        if (!pushRangeRuns(&one, head, len)) {
+            free(one.items);
+            return false;
+        }
+
+        is_single = one.len == 1;
+        if (is_single) {
+            step = one.items[0].lo == one.items[0].hi ? period : one.items[0].step;
+            is_single = period % step == 0 &&
+                        (one.items[0].hi - one.items[0].lo) / step + 1 == period / step;
+        }
+        if (is_single) {
+            uint64_t lo = one.items[0].lo;
+            free(one.items);
+            return pushRange(builder, lo, lo + (q - lo) / step * step, step);
+        }
+        free(one.items);
+    }
+
+    return pushRangeRuns(builder, cursors, len);
+}
+
+// Sorts the first len intervals of rng, which may overlap each other, and
+// rebuilds them into disjoint ones by sweeping over the segments where the set
+// of covering intervals does not change. rng is left as it was on failure.
+static bool normalizeRanges(RangeList* rng, size_t len) {
+    RangeBuilder builder = { NULL, 0, 0, 0 };
+    RangeInterval* items = rng->items;
+    RangeInterval* active = (RangeInterval*)malloc(sizeof(RangeInterval) * (len ? len : 1));
+    RangeCursor* cursors = (RangeCursor*)malloc(sizeof(RangeCursor) * (len ? 2 * len : 1));
+    size_t next = 0, active_len = 0;
+    uint64_t p = 0;
+    uint64_t* ends = NULL;
+    bool is_ok = active && cursors;
+
+    qsort(items, len, sizeof(RangeInterval), compareRangeInterval);
+
+    while (is_ok && (next < len || active_len > 0)) {
+        uint64_t q = UINT64_MAX;
+        size_t kept = 0;
+
+        if (active_len == 0) p = items[next].lo;
+        while (next < len && items[next].lo == p) active[active_len++] = items[next++];
+
+        for (size_t i = 0; i < active_len; ++i) {
+            if (active[i].hi < q) q = active[i].hi;
+        }
+        if (next < len && items[next].lo - 1 < q) q = items[next].lo - 1;
+
+        is_ok = pushRangeSegment(&builder, active, active_len, cursors, p, q);
+        if (q == UINT64_MAX) break;
+
+        p = q + 1;
+        for (size_t i = 0; i < active_len; ++i) {
+            if (active[i].hi >= p) active[kept++] = active[i];
+        }
+        active_len = kept;
+    }
+    free(active);
+    free(cursors);
+
+    if (is_ok) {
+        ends = (uint64_t*)malloc(sizeof(uint64_t) * (builder.len ? builder.len : 1));
+        is_ok = ends != NULL;
+    }
+    if (!is_ok) {
+        free(builder.items);
+        return false;
+    }
+
+    for (size_t i = 0; i < builder.len; ++i) {
+        const RangeInterval* interval = &builder.items[i];
+        uint64_t count = (interval->hi - interval->lo) / interval->step;
+        uint64_t prev = i > 0 ? ends[i - 1] : 0;
+
+        count = count == UINT64_MAX ? UINT64_MAX : count + 1;
+        ends[i] = count > UINT64_MAX - prev ? UINT64_MAX : prev + count;
+    }
+
+    free(rng->items);
+    free(rng->ends);
+    rng->items = builder.items;
+    rng->ends = ends;
+    rng->len = builder.len;
+
+    return true;
+}
+
+// Builds the table with hash and displace (CHD). Choices are hashed into
+// buckets of about 4, and buckets are placed from the largest one: a bucket
+// takes the first displacement which puts all of its choices into free slots.
+// The load factor is at most 0.8, so a placement is found within a few tries.
+// A new seed is tried only when some bucket cannot be placed at all, and the
+// table grows twice after a few seeds, at most CHOICE_TABLE_MAX_GROWTH times.
+#ifndef CHOICE_TABLE_MAX_GROWTH
+#define CHOICE_TABLE_MAX_GROWTH 4
+#endif // CHOICE_TABLE_MAX_GROWTH
+
+static ChoiceTable* buildChoiceTable(const cchar* const* choices, size_t len) {
+    size_t size = 2, buckets = 1, max_size;
+    uint64_t* hashes;
+    uint32_t *next, *heads, *counts, *order;
+
+    if (len >= UINT16_MAX) {
+        clparse_err = CLPARSE_ERR_KIND_INVALID_CHOICES;
+        err_msg_detail = "too many choices";
+        return NULL;
+    }
+
+    while (size < len + len / 4) size <<= 1;
+    max_size = size << CHOICE_TABLE_MAX_GROWTH;
+    while (buckets * 4 < len) buckets <<= 1;
+
+    // hashes and bucket chains of choices, and buckets sorted by their sizes
+    hashes = (uint64_t*)malloc(sizeof(uint64_t) * (len ? len : 1) +
+                               sizeof(uint32_t) * (len + 2 * buckets + len + 2));
+    if (!hashes) {
+        clparse_err = CLPARSE_INTERNAL_ERROR;
+        err_msg_detail = "clparseChoice (allocation)";
+        return NULL;
+    }
+    next = (uint32_t*)(hashes + (len ? len : 1));
+    heads = next + len;
+    order = heads + buckets;
+    counts = order + buckets;
+
+    for (;; size <<= 1) {
+        ChoiceTable* table = (ChoiceTable*)malloc(sizeof(ChoiceTable) +
+                                                  sizeof(uint32_t) * buckets +
+                                                  sizeof(uint16_t) * size);
+        if (!table) {
+            free(hashes);
+            clparse_err = CLPARSE_INTERNAL_ERROR;
+            err_msg_detail = "clparseChoice (allocation)";
+            return NULL;
+        }
+        table->displacements = (uint32_t*)(table + 1);
+        table->slots = (uint16_t*)(table->displacements + buckets);
+        table->choices = choices;
+        table->len = len;
+        table->mask = (uint32_t)(size - 1);
+        table->bucket_mask = (uint32_t)(buckets - 1);
+
+        for (uint32_t seed = 0; seed < 8; ++seed) {
+            size_t placed = 0;
+
+            memset(heads, 0xff, sizeof(uint32_t) * buckets);
+            memset(counts, 0, sizeof(uint32_t) * (len + 2));
+            for (size_t i = 0; i < len; ++i) {
+                uint32_t bucket;
+
+                hashes[i] = hashChoice(choices[i], seed);
+                bucket = (uint32_t)hashes[i] & table->bucket_mask;
+                // the same strings always share a bucket, so check them here
+                for (uint32_t j = heads[bucket]; j != UINT32_MAX; j = next[j]) {
+                    if (hashes[j] == hashes[i] && cstrcmp(choices[j], choices[i]) == 0) {
+                        free(table);
+                        free(hashes);
+                        clparse_err = CLPARSE_ERR_KIND_INVALID_CHOICES;
+                        err_msg_detail = "duplicated choices";
+                        return NULL;
+                    }
+                }
+                next[i] = heads[bucket];
+                heads[bucket] = (uint32_t)i;
+            }
+
+            // counting sort of buckets, the largest first
+            for (size_t b = 0; b < buckets; ++b) {
+                size_t bucket_len = 0;
+                for (uint32_t j = heads[b]; j != UINT32_MAX; j = next[j]) ++bucket_len;
+                counts[len - bucket_len + 1] += 1;
+                table->displacements[b] = (uint32_t)bucket_len; // reused below
+            }
+            for (size_t k = 1; k <= len; ++k) counts[k] += counts[k - 1];
+            for (size_t b = 0; b < buckets; ++b) {
+                order[counts[len - table->displacements[b]]++] = (uint32_t)b;
+            }
+
+            memset(table->slots, 0, sizeof(uint16_t) * size);
+            for (; placed < buckets; ++placed) {
+                uint32_t bucket = order[placed];
+                uint32_t disp, j = UINT32_MAX;
+
+                // f1 + disp * f2 with an odd f2 visits every slot once
+                for (disp = 0; disp < size; ++disp) {
+                    for (j = heads[bucket]; j != UINT32_MAX; j = next[j]) {
+                        uint16_t* slot = &table->slots[choiceSlot(hashes[j], disp, table->mask)];
+                        if (*slot) break;
+                        *slot = (uint16_t)(j + 1);
+                    }
+                    if (j == UINT32_MAX) break;
+
+                    for (uint32_t k = heads[bucket]; k != j; k = next[k]) {
+                        table->slots[choiceSlot(hashes[k], disp, table->mask)] = 0;
+                    }
+                }
+                if (j != UINT32_MAX) break;
+                table->displacements[bucket] = disp;
+            }
+
+            if (placed == buckets) {
+                table->seed = seed;
+                free(hashes);
+                return table;
+            }
+        }
+
+        free(table);
+        if (size >= max_size) break;
+    }
+
+    free(hashes);
+    clparse_err = CLPARSE_ERR_KIND_INVALID_CHOICES;
+    err_msg_detail = "no perfect hash is found";
+    return NULL;
+}
+
+// seeded fnv1a with a final mix, so that every bit depends on every letter
+static uint64_t hashChoice(const cchar* str, uint32_t seed) {
+    uint64_t hash = 0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+    const uint64_t prime = 0x100000001b3ULL;
+
+    while (*str) {
+        hash = ((uint64_t)*str++ ^ hash) * prime;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// The low bits of hash pick the bucket, and the rest the slot
+static uint32_t choiceSlot(uint64_t hash, uint32_t disp, uint32_t mask) {
+    uint32_t base = (uint32_t)(hash >> 32);
+    uint32_t stride = (uint32_t)hash >> 16 | 1;
+    return (base + disp * stride) & mask;
+}
+
+// Returns `index + 1` of value, or 0 if it is not one of choices
+static uint16_t findChoice(const ChoiceTable* table, const cchar* value) {
+    uint64_t hash = hashChoice(value, table->seed);
+    uint32_t disp = table->displacements[(uint32_t)hash & table->bucket_mask];
+    uint16_t slot = table->slots[choiceSlot(hash, disp, table->mask)];
+
+    if (slot == 0 || cstrcmp(table->choices[slot - 1], value) != 0) return 0;
+    return slot;
+}
+
+static int compareRangeInterval(const void* lhs, const void* rhs) {
+    const RangeInterval* lhs_interval = (const RangeInterval*)lhs;
+    const RangeInterval* rhs_interval = (const RangeInterval*)rhs;
+
+    if (lhs_interval->lo != rhs_interval->lo) {
+        return lhs_interval->lo < rhs_interval->lo ? -1 : 1;
+    }
+    if (lhs_interval->hi != rhs_interval->hi) {
+        return lhs_interval->hi > rhs_interval->hi ? -1 : 1;
+    }
+    return 0;
+}
+
+#ifndef USE_WIDE_ARGV
+// collects every subcommand and flag names into one allocation. Entries come
+// first, and the words (`--name` and `-n`) are stored right after them. Lazy
+// subcommands which are not built yet add no flags.
+static bool buildCompletionTable(CompletionTable* table) {
+    size_t entries_len = subcommands_len, bytes_len = 0;
+    CompletionEntry* entries;
+    char* bytes;
+
+    for (size_t i = 0; i <= subcommands_len; ++i) {
+        const Flag* flags = i < subcommands_len ? subcommands[i].flags : main_flags;
+        size_t flags_len = i < subcommands_len ? subcommands[i].flags_len : main_flags_len;
+
+        for (size_t j = 0; j < flags_len; ++j) {
+            if (flags[j].name[0]) {
+                ++entries_len;
+                bytes_len += strlen(flags[j].name) + 3;
+            }
+            if (flags[j].short_name != NO_SHORT) {
+                ++entries_len;
+                bytes_len += 3;
+            }
+        }
+    }
+
+    entries = (CompletionEntry*)malloc(sizeof(CompletionEntry) * entries_len + bytes_len);
+    if (!entries) return false;
+    bytes = (char*)(entries + entries_len);
+    table->entries = entries;
+    table->len = entries_len;
+
+    for (size_t i = 0; i < subcommands_len; ++i) {
+        entries->scope = "";
+        entries->word = subcommands[i].name;
+        entries->has_value = false;
+        ++entries;
+    }
+
+    for (size_t i = 0; i <= subcommands_len; ++i) {
+        const char* scope = i < subcommands_len ? subcommands[i].name : "";
+        const Flag* flags = i < subcommands_len ? subcommands[i].flags : main_flags;
+        size_t flags_len = i < subcommands_len ? subcommands[i].flags_len : main_flags_len;
+
+        for (size_t j = 0; j < flags_len; ++j) {
+            if (flags[j].name[0]) {
+                entries->scope = scope;
+                entries->word = bytes;
+                entries->has_value = flags[j].type != FLAG_TYPE_BOOL;
+                ++entries;
+                bytes += sprintf(bytes, "--%s", flags[j].name) + 1;
+            }
+            if (flags[j].short_name != NO_SHORT) {
+                entries->scope = scope;
+                entries->word = bytes;
+                entries->has_value = flags[j].type != FLAG_TYPE_BOOL;
+                ++entries;
+                bytes += sprintf(bytes, "-%c", flags[j].short_name) + 1;
+            }
+        }
+    }
+
+    qsort((void*)table->entries, table->len, sizeof(CompletionEntry), compareCompletionEntry);
+    return true;
+}
+
+static int compareCompletionKey(const CompletionEntry* entry, const char* scope, const char* word) {
+    int cmp = strcmp(entry->scope, scope);
+    return cmp != 0 ? cmp : strcmp(entry->word, word);
+}
+
+static size_t lowerBoundCompletion(const CompletionTable* table, const char* scope, const char* word) {
+    size_t lo = 0, hi = table->len;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (compareCompletionKey(&table->entries[mid], scope, word) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+static int compareCompletionEntry(const void* lhs, const void* rhs) {
+    const CompletionEntry* rhs_entry = (const CompletionEntry*)rhs;
+    return compareCompletionKey((const CompletionEntry*)lhs, rhs_entry->scope, rhs_entry->word);
+}
+
+// writes str as a C string literal. Control characters are written in octal
+// with three digits, so that a following digit is not taken into the escape,
+// and `?` is escaped against trigraphs.
+static void dumpStringLiteral(const char* str, FILE* out) {
+    fputc('"', out);
+    for (; *str; ++str) {
+        unsigned char ch = (unsigned char)*str;
+        if (ch == '"' || ch == '\\' || ch == '?') {
+            fputc('\\', out);
+            fputc(ch, out);
+        } else if (ch < 0x20 || ch == 0x7f) {
+            fprintf(out, "\\%03o", ch);
+        } else {
+            fputc(ch, out);
+        }
+    }
+    fputc('"', out);
+}
+#endif // USE_WIDE_ARGV
+
+// writes str as UTF-8 into output and returns the number of bytes. If output is
+// NULL, it only counts them. ASCII runs are handled four code units at a time.
+static size_t transcodeUtf16(char* output, const uint16_t* str) {
+    const uint16_t* end = str;
+    size_t len = 0;
+
+    while (*end) ++end;
+
+    while (str < end) {
+        uint64_t word;
+        uint32_t code;
+
+        if (end - str >= 4) {
+            memcpy(&word, str, sizeof(word));
+            if ((word & UINT64_C(0xFF80FF80FF80FF80)) == 0) {
+                if (output) {
+                    output[len] = (char)str[0];
+                    output[len + 1] = (char)str[1];
+                    output[len + 2] = (char)str[2];
+                    output[len + 3] = (char)str[3];
+                }
+                len += 4;
+                str += 4;
+                continue;
+            }
+        }
+
+        code = *str++;
+        if (code >= 0xD800 && code <= 0xDBFF && str < end &&
+                *str >= 0xDC00 && *str <= 0xDFFF) {
+            code = 0x10000 + ((code - 0xD800) << 10) + (*str++ - 0xDC00);
+        }
+
+        if (code < 0x80) {
+            if (output) output[len] = (char)code;
+            len += 1;
+        } else if (code < 0x800) {
+            if (output) {
+                output[len] = (char)(0xC0 | (code >> 6));
+                output[len + 1] = (char)(0x80 | (code & 0x3F));
+            }
+            len += 2;
+        } else if (code < 0x10000) {
+            if (output) {
+                output[len] = (char)(0xE0 | (code >> 12));
+                output[len + 1] = (char)(0x80 | ((code >> 6) & 0x3F));
+                output[len + 2] = (char)(0x80 | (code & 0x3F));
+            }
+            len += 3;
+        } else {
+            if (output) {
+                output[len] = (char)(0xF0 | (code >> 18));
+                output[len + 1] = (char)(0x80 | ((code >> 12) & 0x3F));
+                output[len + 2] = (char)(0x80 | ((code >> 6) & 0x3F));
+                output[len + 3] = (char)(0x80 | (code & 0x3F));
+            }
+            len += 4;
+        }
+    }
+
+    return len;
+}
+
+int cprintf_impl_(const cchar* fmt, ...) {
+#if defined(USE_WIDE_ARGV) && defined(_WIN32)
+    va_list args;
+    va_start(args, fmt);
+    int len = vswprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (len < 0) return -1;
+
+    wchar_t* buf = (wchar_t*)malloc(sizeof(wchar_t) * (len + 1));
+    va_start(args, fmt);
+    len = vswprintf(buf, len + 1, fmt, args);
+    va_end(args);
+    if (len < 0) return -1;
+
+    DWORD written;
+    HANDLE stderr_h = GetStdHandle(STD_ERROR_HANDLE);
+    WriteConsoleW(stderr_h, buf, len, &written, NULL);
+    free(buf);
+    return written;
+#elif defined(USE_WIDE_ARGV)
+    va_list args;
+    va_start(args, fmt);
+    int len = vfwprintf(stderr, fmt, args);
+    va_end(args);
+    return len;
 #else
     va_list args;
     va_start(args, fmt);
@@ -0,0 +1,475 @@
+/*
+Copyright (C) 2021-2025  Sungbae Jeong
+
+This file is distributed under the same license as clparse.h.
+
+//////////////////////////////////////////////////////////////////////////////
+
+C++17 layer over clparse.h
+
+It is header only as well. Define `CLPARSE_IMPLEMENTATION` before including this
+file (instead of clparse.h) on the one of the source file.
+
+# Usage
+    clparse::Parser parser("foo", "description");
+    auto num = parser.flag<int32_t>("num", 'n', 0, "a number");
+    auto ids = parser.list<uint32_t>("ids", 'i', "ids");
+    if (auto res = parser.parse(argc, argv); !res) {
+        std::fprintf(stderr, "%s\n", res.error().message);
+    }
+    int32_t n = num->get();
+    for (uint32_t id : ids->get()) { ... }
+
+Values are not copied: strings are views into argv and lists are spans over
+the storage of clparse. Nothing in this file throws.
+*/
+
+#ifndef CLPARSE_CPP_LIBRARY_HPP_
+#define CLPARSE_CPP_LIBRARY_HPP_
+
+#include <cassert>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#if __has_include(<span>) && __cplusplus >= 202002L
+#   include <span>
+#endif
+
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#   include <coroutine>
+#   include <iterator>
+#endif
+
+namespace clparse {
+namespace detail {
+
+// A drop-in replacement of `strtoull(str, end, 0)` on top of std::from_chars.
+// It handles the sign and the `0x`/`0` prefixes by itself, since from_chars
+// does not.
+template <typename Char>
+inline bool parseInteger(const Char* str, Char** end, std::uint64_t* output) {
+    const Char* ptr = str;
+    const Char* last;
+    bool is_negative = false;
+    int base = 10;
+
+    if (*ptr == Char('+') || *ptr == Char('-')) is_negative = *ptr++ == Char('-');
+
+    if (ptr[0] == Char('0') && (ptr[1] == Char('x') || ptr[1] == Char('X'))) {
+        Char digit = ptr[2];
+        if ((digit >= Char('0') && digit <= Char('9')) ||
+                (digit >= Char('a') && digit <= Char('f')) ||
+                (digit >= Char('A') && digit <= Char('F'))) {
+            base = 16;
+            ptr += 2;
+        }
+    } else if (ptr[0] == Char('0')) {
+        base = 8;
+    }
+
+    // from_chars needs the end of the number, so find it before converting
+    for (last = ptr;; ++last) {
+        Char ch = *last;
+        if (ch >= Char('0') && ch <= Char('0' + (base < 10 ? base : 10) - 1)) continue;
+        if (base == 16 && ((ch >= Char('a') && ch <= Char('f')) ||
+                           (ch >= Char('A') && ch <= Char('F')))) continue;
+        break;
+    }
+    if (last == ptr) {
+        *end = const_cast<Char*>(str);
+        return false;
+    }
+
+    std::from_chars_result res;
+    if constexpr (sizeof(Char) == 1) {
+        res = std::from_chars(reinterpret_cast<const char*>(ptr),
+                              reinterpret_cast<const char*>(last), *output, base);
+    } else {
+        // digits are ASCII, so wide strings are narrowed first
+        char buf[72];
+        std::size_t len = static_cast<std::size_t>(last - ptr);
+        if (len > sizeof(buf)) return false;
+        for (std::size_t i = 0; i < len; ++i) buf[i] = static_cast<char>(ptr[i]);
+        res = std::from_chars(buf, buf + len, *output, base);
+    }
+    if (res.ec != std::errc()) return false;
+
+    if (is_negative) *output = 0 - *output;
+    *end = const_cast<Char*>(last);
+    return true;
+}
+
+} // namespace detail
+} // namespace clparse
+
+#ifndef CLPARSE_PARSE_INTEGER
+#   define CLPARSE_PARSE_INTEGER(_str, _end, _output)                          \
+        ::clparse::detail::parseInteger(_str, _end, _output)
+#endif // CLPARSE_PARSE_INTEGER
+
+#include "clparse.h"
+
+namespace clparse {
+
+using StringView = std::basic_string_view<cchar>;
+
+#if defined(__cpp_lib_span)
+template <typename V>
+using Span = std::span<const V>;
+#else
+// a minimal read only std::span for C++17
+template <typename V>
+class Span {
+  public:
+    constexpr Span() noexcept : data_(nullptr), size_(0) {}
+    constexpr Span(const V* data, std::size_t size) noexcept : data_(data), size_(size) {}
+
+    constexpr const V* data() const noexcept { return data_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return size_ == 0; }
+    constexpr const V* begin() const noexcept { return data_; }
+    constexpr const V* end() const noexcept { return data_ + size_; }
+    constexpr const V& operator[](std::size_t idx) const noexcept { return data_[idx]; }
+
+  private:
+    const V* data_;
+    std::size_t size_;
+};
+#endif // __cpp_lib_span
+
+// An error from clparse. The message is owned by clparse.
+struct Error {
+    const char* message;
+};
+
+// A std::expected like result which never throws. V need not be default
+// constructible, as an error holds no V at all.
+template <typename V>
+class Expected {
+  public:
+    Expected(V value) : value_(std::move(value)), err_{nullptr} {}
+    Expected(Error err) : value_(), err_(err) {}
+
+    bool has_value() const noexcept { return value_.has_value(); }
+    explicit operator bool() const noexcept { return value_.has_value(); }
+
+    const V& value() const noexcept {
+        assert(value_.has_value() && "Expected holds an error");
+        return *value_;
+    }
+    const V& operator*() const noexcept { return value(); }
+    const V* operator->() const noexcept { return &value(); }
+    const Error& error() const noexcept { return err_; }
+
+  private:
+    std::optional<V> value_;
+    Error err_;
+};
+
+template <>
+class Expected<void> {
+  public:
+    Expected() : err_{nullptr}, has_value_(true) {}
+    Expected(Error err) : err_(err), has_value_(false) {}
+
+    bool has_value() const noexcept { return has_value_; }
+    explicit operator bool() const noexcept { return has_value_; }
+    const Error& error() const noexcept { return err_; }
+
+  private:
+    Error err_;
+    bool has_value_;
+};
+
+// A handle of a flag. It reads the value stored in clparse directly.
+template <typename V>
+class Value {
+  public:
+    Value() noexcept : ptr_(nullptr) {}
+    explicit Value(const V* ptr) noexcept : ptr_(ptr) {}
+
+    V get() const noexcept { return *ptr_; }
+    const V* handle() const noexcept { return ptr_; }
+
+  private:
+    const V* ptr_;
+};
+
+template <>
+class Value<const cchar*> {
+  public:
+    Value() noexcept : ptr_(nullptr) {}
+    explicit Value(const cchar* const* ptr) noexcept : ptr_(ptr) {}
+
+    StringView get() const noexcept { return *ptr_ ? StringView(*ptr_) : StringView(); }
+    bool is_set() const noexcept { return *ptr_ != nullptr; }
+    const cchar* const* handle() const noexcept { return ptr_; }
+
+  private:
+    const cchar* const* ptr_;
+};
+
+// A handle of a list flag. Items are seen through a span over ArrayList.
+template <typename V>
+class List {
+  public:
+    List() noexcept : lst_(nullptr) {}
+    explicit List(const ArrayList* lst) noexcept : lst_(lst) {}
+
+    Span<V> get() const noexcept {
+        return Span<V>(static_cast<const V*>(lst_->items), lst_->len);
+    }
+    std::size_t size() const noexcept { return lst_->len; }
+    const ArrayList* handle() const noexcept { return lst_; }
+
+  private:
+    const ArrayList* lst_;
+};
+
+namespace detail {
+
+template <typename V>
+struct FlagTraits;
+
+#define T(_name, _type, _foo1, _foo2, _foo3)                                   \
+    template <>                                                                \
+    struct FlagTraits<_type> {                                                 \
+        using value_type = _type;                                              \
+                                                                               \
+        static value_type* add(const cchar* flag_name, cchar short_name,      \
+                value_type dfault, const cchar* desc, const cchar* subcmd) {   \
+            return clparse##_name(flag_name, short_name, dfault, desc, subcmd);\
+        }                                                                      \
+                                                                               \
+        static const ArrayList* addList(const cchar* flag_name,                \
+                cchar short_name, const cchar* desc, const cchar* subcmd) {    \
+            return clparse##_name##List(                                       \
+                flag_name, short_name, value_type{}, desc, subcmd);            \
+        }                                                                      \
+    };
+
+CLPARSE_TYPES(T)
+#undef T
+
+inline Error lastError() {
+    const char* msg = clparseGetErr();
+    return Error{ msg ? msg : "Unknown error" };
+}
+
+inline bool& isParserAlive() {
+    static bool is_alive = false;
+    return is_alive;
+}
+
+} // namespace detail
+
+// Owns the state of clparse. clparse keeps it globally, thus only one Parser
+// can be alive at once.
+class Parser {
+  public:
+    Parser(const cchar* name, const cchar* desc) : owns_(true) {
+        assert(!detail::isParserAlive() && "only one clparse::Parser can be alive");
+        detail::isParserAlive() = true;
+        clparseInit(name, desc);
+    }
+
+    ~Parser() {
+        if (owns_) {
+            clparseDeinit();
+            detail::isParserAlive() = false;
+        }
+    }
+
+    Parser(const Parser&) = delete;
+    Parser& operator=(const Parser&) = delete;
+
+    Parser(Parser&& other) noexcept : owns_(other.owns_) { other.owns_ = false; }
+    Parser& operator=(Parser&& other) noexcept {
+        std::swap(owns_, other.owns_);
+        return *this;
+    }
+
+    template <typename V>
+    Expected<Value<V>> flag(const cchar* flag_name, cchar short_name, V dfault,
+            const cchar* desc, const cchar* subcmd = NO_SUBCMD) {
+        const V* ptr = detail::FlagTraits<V>::add(flag_name, short_name, dfault, desc, subcmd);
+        if (!ptr) return detail::lastError();
+        return Value<V>(ptr);
+    }
+
+    template <typename V>
+    Expected<List<V>> list(const cchar* flag_name, cchar short_name,
+            const cchar* desc, const cchar* subcmd = NO_SUBCMD) {
+        const ArrayList* lst = detail::FlagTraits<V>::addList(flag_name, short_name, desc, subcmd);
+        if (!lst) return detail::lastError();
+        return List<V>(lst);
+    }
+
+    Expected<const RangeList*> range(const cchar* flag_name, cchar short_name,
+            const cchar* desc, const cchar* subcmd = NO_SUBCMD) {
+        const RangeList* rng = clparseRange(flag_name, short_name, desc, subcmd);
+        if (!rng) return detail::lastError();
+        return rng;
+    }
+
+    Expected<Value<std::size_t>> choice(const cchar* flag_name, cchar short_name,
+            std::size_t dfault, const cchar* const* choices, std::size_t choices_len,
+            const cchar* desc, const cchar* subcmd = NO_SUBCMD) {
+        const std::size_t* ptr = clparseChoice(flag_name, short_name, dfault,
+                                               choices, choices_len, desc, subcmd);
+        if (!ptr) return detail::lastError();
+        return Value<std::size_t>(ptr);
+    }
+
+    Expected<Value<bool>> subcmd(const cchar* subcmd_name, const cchar* desc) {
+        const bool* ptr = clparseSubcmd(subcmd_name, desc);
+        if (!ptr) return detail::lastError();
+        return Value<bool>(ptr);
+    }
+
+    Expected<Value<bool>> subcmd(const cchar* subcmd_name, const cchar* desc,
+            ClparseSubcmdBuilder builder, void* ctx) {
+        const bool* ptr = clparseSubcmdLazy(subcmd_name, desc, builder, ctx);
+        if (!ptr) return detail::lastError();
+        return Value<bool>(ptr);
+    }
+
+    Expected<Value<const cchar*>> mainArg(const cchar* name, const cchar* desc,
+            const cchar* subcmd = NO_SUBCMD) {
+        const cchar** ptr = clparseMainArg(name, desc, subcmd);
+        if (!ptr) return detail::lastError();
+        return Value<const cchar*>(ptr);
+    }
+
+    Expected<const ArgvSlice*> mainArgs(const cchar* name, const cchar* desc,
+            const cchar* subcmd = NO_SUBCMD) {
+        const ArgvSlice* slice = clparseMainArgs(name, desc, subcmd);
+        if (!slice) return detail::lastError();
+        return slice;
+    }
+
+    const ArgvSlice* passthrough() const { return clparsePassthrough(); }
+
+    void setLimits(const ClparseLimits& limits) { clparseSetLimits(&limits); }
+
+    // Constraints take the handle() of values of one scope
+    Expected<void> required(const void* flag) {
+        if (!clparseRequired(flag)) return detail::lastError();
+        return Expected<void>();
+    }
+
+    Expected<void> exclusive(std::initializer_list<const void*> flags) {
+        if (!clparseExclusive(flags.begin(), flags.size())) return detail::lastError();
+        return Expected<void>();
+    }
+
+    // `requires` is a keyword since C++20
+    Expected<void> depends(const void* flag, const void* dependency) {
+        if (!clparseRequires(flag, dependency)) return detail::lastError();
+        return Expected<void>();
+    }
+
+    Expected<void> parse(int argc, cchar** argv) {
+        if (!clparseParse(argc, argv)) return detail::lastError();
+        return Expected<void>();
+    }
+
+    // Reads values from a block made by clparseSerialize instead of parsing.
+    // The block must outlive the parser.
+    Expected<void> attach(const void* block, size_t size) {
+        if (!clparseAttach(block, size)) return detail::lastError();
+        return Expected<void>();
+    }
+
+    bool isHelp() const { return clparseIsHelp(); }
+    void printHelp() const { clparsePrintHelp(); }
+
+  private:
+    bool owns_;
+};
+
+#if defined(__cpp_impl_coroutine) && defined(__cpp_lib_coroutine)
+// A C++20 generator over clparseNext. The last event is CLPARSE_EVENT_ERROR if
+// parsing failed; otherwise the sequence just ends. Breaking out of the loop
+// stops parsing there.
+class Events {
+  public:
+    struct promise_type {
+        ClparseEvent current;
+
+        Events get_return_object() noexcept {
+            return Events(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        std::suspend_always final_suspend() const noexcept { return {}; }
+        std::suspend_always yield_value(const ClparseEvent& event) noexcept {
+            current = event;
+            return {};
+        }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept {}
+    };
+
+    class iterator {
+      public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = ClparseEvent;
+        using difference_type = std::ptrdiff_t;
+
+        explicit iterator(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+
+        const ClparseEvent& operator*() const noexcept { return handle_.promise().current; }
+        const ClparseEvent* operator->() const noexcept { return &handle_.promise().current; }
+        iterator& operator++() noexcept {
+            handle_.resume();
+            return *this;
+        }
+        void operator++(int) noexcept { ++*this; }
+        bool operator==(std::default_sentinel_t) const noexcept { return handle_.done(); }
+
+      private:
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    Events(const Events&) = delete;
+    Events& operator=(const Events&) = delete;
+    Events(Events&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    Events& operator=(Events&& other) noexcept {
+        std::swap(handle_, other.handle_);
+        return *this;
+    }
+    ~Events() {
+        if (handle_) handle_.destroy();
+    }
+
+    iterator begin() {
+        handle_.resume();
+        return iterator(handle_);
+    }
+    std::default_sentinel_t end() const noexcept { return {}; }
+
+  private:
+    explicit Events(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+inline Events events(int argc, cchar** argv) {
+    ClparseIter iter;
+    ClparseEvent event;
+
+    clparseIterInit(&iter, argc, argv);
+    while (clparseNext(&iter, &event)) co_yield event;
+    if (event.kind == CLPARSE_EVENT_ERROR) co_yield event;
+}
+#endif // __cpp_impl_coroutine
+
+} // namespace clparse
+
+#endif // CLPARSE_CPP_LIBRARY_HPP_
@@ -0,0 +1,503 @@
+/*
+Copyright (C) 2021-2025  Sungbae Jeong
+
+This file is distributed under the same license as clparse.h.
+
+//////////////////////////////////////////////////////////////////////////////
+
+Tests of clparse.hpp, and of the parts of clparse.h which it does not wrap
+
+    c++ -std=c++17 -I. test.cpp -o test && ./test
+    c++ -std=c++20 -I. test.cpp -o test && ./test   # events() as well
+
+It prints every failed check and exits with 1 if there is any.
+*/
+
+#define CLPARSE_IMPLEMENTATION
+#include <clparse.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static int failed = 0;
+
+#define CHECK(_cond)                                                           \
+    do {                                                                       \
+        if (!(_cond)) {                                                        \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n",                 \
+                         __FILE__, __LINE__, #_cond);                          \
+            ++failed;                                                          \
+        }                                                                      \
+    } while (0)
+
+// clparse never writes into argv strings, so literals can be given
+class Args {
+  public:
+    Args(std::initializer_list<const cchar*> args) {
+        for (const cchar* arg : args) items_.push_back(const_cast<cchar*>(arg));
+    }
+
+    int argc() const { return static_cast<int>(items_.size()); }
+    cchar** argv() { return items_.data(); }
+
+  private:
+    std::vector<cchar*> items_;
+};
+
+static bool parseU64(const cchar* str, std::uint64_t expected, std::size_t consumed) {
+    cchar* end = nullptr;
+    std::uint64_t output = 0;
+    if (!clparse::detail::parseInteger(str, &end, &output)) return false;
+    return output == expected && end == str + consumed;
+}
+
+static bool isRejected(const cchar* str) {
+    cchar* end = nullptr;
+    std::uint64_t output = 0;
+    return !clparse::detail::parseInteger(str, &end, &output);
+}
+
+static void testParseInteger() {
+    CHECK(parseU64(CSTR("0"), 0, 1));
+    CHECK(parseU64(CSTR("42"), 42, 2));
+    CHECK(parseU64(CSTR("+42"), 42, 3));
+    CHECK(parseU64(CSTR("-1"), UINT64_MAX, 2));
+    CHECK(parseU64(CSTR("0x1f"), 0x1f, 4));
+    CHECK(parseU64(CSTR("0XFF"), 0xff, 4));
+    CHECK(parseU64(CSTR("017"), 017, 3));
+    CHECK(parseU64(CSTR("18446744073709551615"), UINT64_MAX, 20));
+    CHECK(parseU64(CSTR("0xffffffffffffffff"), UINT64_MAX, 18));
+
+    // as strtoull does, the number stops before what is not a digit
+    CHECK(parseU64(CSTR("12abc"), 12, 2));
+    CHECK(parseU64(CSTR("0x"), 0, 1));
+    CHECK(parseU64(CSTR("0xg"), 0, 1));
+    CHECK(parseU64(CSTR("08"), 0, 1));
+
+    CHECK(isRejected(CSTR("")));
+    CHECK(isRejected(CSTR("-")));
+    CHECK(isRejected(CSTR("abc")));
+    CHECK(isRejected(CSTR("18446744073709551616")));
+    CHECK(isRejected(CSTR("0x10000000000000000")));
+
+    cchar* end = nullptr;
+    std::uint64_t output = 7;
+    const cchar* str = CSTR("x");
+    CHECK(!clparse::detail::parseInteger(str, &end, &output));
+    CHECK(end == str);
+}
+
+static void testValues() {
+    clparse::Parser parser(CSTR("test"), CSTR("values"));
+    auto num = parser.flag<std::int32_t>(CSTR("num"), CSTR('n'), 5, CSTR("a number"));
+    auto big = parser.flag<std::uint64_t>(CSTR("big"), NO_SHORT, 0, CSTR("a big number"));
+    auto verbose = parser.flag<bool>(CSTR("verbose"), CSTR('v'), false, CSTR("verbose"));
+    auto name = parser.flag<const cchar*>(CSTR("name"), NO_SHORT, nullptr, CSTR("a name"));
+    auto file = parser.mainArg(CSTR("FILE"), CSTR("a file"));
+    CHECK(num && big && verbose && name && file);
+
+    Args args{ CSTR("test"), CSTR("-n"), CSTR("-12"), CSTR("--big=0x10"),
+               CSTR("-v"), CSTR("--name"), CSTR("foo"), CSTR("a.txt") };
+    auto res = parser.parse(args.argc(), args.argv());
+    CHECK(res);
+    if (!res) return;
+
+    CHECK(num->get() == -12);
+    CHECK(big->get() == 16);
+    CHECK(verbose->get());
+    CHECK(name->is_set());
+    CHECK(name->get() == clparse::StringView(CSTR("foo")));
+    CHECK(file->get() == clparse::StringView(CSTR("a.txt")));
+    CHECK(!parser.isHelp());
+}
+
+static void testDefaults() {
+    clparse::Parser parser(CSTR("test"), CSTR("defaults"));
+    auto num = parser.flag<std::int32_t>(CSTR("num"), CSTR('n'), 5, CSTR("a number"));
+    auto name = parser.flag<const cchar*>(CSTR("name"), NO_SHORT, nullptr, CSTR("a name"));
+    auto ids = parser.list<std::uint32_t>(CSTR("ids"), CSTR('i'), CSTR("ids"));
+
+    Args args{ CSTR("test") };
+    CHECK(parser.parse(args.argc(), args.argv()));
+    CHECK(num->get() == 5);
+    CHECK(!name->is_set());
+    CHECK(name->get().empty());
+    CHECK(ids->size() == 0);
+    CHECK(ids->get().empty());
+}
+
+static void testLists() {
+    clparse::Parser parser(CSTR("test"), CSTR("lists"));
+    auto ids = parser.list<std::uint32_t>(CSTR("ids"), CSTR('i'), CSTR("ids"));
+    auto offs = parser.list<std::int64_t>(CSTR("offs"), NO_SHORT, CSTR("offsets"));
+    auto tags = parser.list<const cchar*>(CSTR("tags"), CSTR('t'), CSTR("tags"));
+    auto cpus = parser.range(CSTR("cpus"), NO_SHORT, CSTR("cpus"));
+    CHECK(ids && offs && tags && cpus);
+
+    Args args{ CSTR("test"), CSTR("--ids"), CSTR("1,2"), CSTR("3"),
+               CSTR("--offs=-1,0x10"), CSTR("-t"), CSTR("a"), CSTR("b"),
+               CSTR("--cpus"), CSTR("0-7:2,4-5") };
+    auto res = parser.parse(args.argc(), args.argv());
+    CHECK(res);
+    if (!res) return;
+
+    const std::uint32_t expected_ids[] = { 1, 2, 3 };
+    clparse::Span<std::uint32_t> id_span = ids->get();
+    CHECK(id_span.size() == 3);
+    CHECK(std::memcmp(id_span.data(), expected_ids, sizeof(expected_ids)) == 0);
+
+    std::int64_t sum = 0;
+    for (std::int64_t off : offs->get()) sum += off;
+    CHECK(offs->size() == 2);
+    CHECK(sum == 15);
+
+    clparse::Span<const cchar*> tag_span = tags->get();
+    CHECK(tag_span.size() == 2);
+    CHECK(clparse::StringView(tag_span[0]) == clparse::StringView(CSTR("a")));
+    CHECK(clparse::StringView(tag_span[1]) == clparse::StringView(CSTR("b")));
+
+    // {0, 2, 4, 6} and {4, 5}
+    CHECK(clparseRangeCount(*cpus) == 5);
+    CHECK(clparseRangeContains(*cpus, 5));
+    CHECK(!clparseRangeContains(*cpus, 3));
+}
+
+static void testParseAgain() {
+    clparse::Parser parser(CSTR("test"), CSTR("parse again"));
+    auto num = parser.flag<std::int32_t>(CSTR("num"), CSTR('n'), 5, CSTR("a number"));
+    auto ids = parser.list<std::uint32_t>(CSTR("ids"), CSTR('i'), CSTR("ids"));
+
+    // every parse starts from the defaults, so nothing is carried over
+    Args first{ CSTR("test"), CSTR("-n"), CSTR("1"), CSTR("--ids"), CSTR("1,2") };
+    Args second{ CSTR("test"), CSTR("--ids"), CSTR("3") };
+    CHECK(parser.parse(first.argc(), first.argv()));
+    CHECK(parser.parse(second.argc(), second.argv()));
+    CHECK(num->get() == 5);
+    CHECK(ids->size() == 1 && ids->get()[0] == 3);
+}
+
+static void testChoiceAndSubcmd() {
+    static const cchar* const modes[] = { CSTR("fast"), CSTR("safe"), CSTR("debug") };
+
+    clparse::Parser parser(CSTR("test"), CSTR("subcommands"));
+    auto build = parser.subcmd(CSTR("build"), CSTR("build it"));
+    auto mode = parser.choice(CSTR("mode"), CSTR('m'), 0, modes, 3, CSTR("a mode"), CSTR("build"));
+    auto jobs = parser.flag<std::uint8_t>(CSTR("jobs"), CSTR('j'), 1, CSTR("jobs"), CSTR("build"));
+    CHECK(build && mode && jobs);
+
+    Args args{ CSTR("test"), CSTR("build"), CSTR("-m"), CSTR("debug"), CSTR("-j"), CSTR("8") };
+    CHECK(parser.parse(args.argc(), args.argv()));
+    CHECK(build->get());
+    CHECK(mode->get() == 2);
+    CHECK(jobs->get() == 8);
+
+    // invalid choices are refused even without assert
+    static const cchar* const twice[] = { CSTR("a"), CSTR("a") };
+    CHECK(!parser.choice(CSTR("none"), NO_SHORT, 0, modes, 0, CSTR("x")));
+    CHECK(!parser.choice(CSTR("out"), NO_SHORT, 3, modes, 3, CSTR("x")));
+    CHECK(!parser.choice(CSTR("dup"), NO_SHORT, 0, twice, 2, CSTR("x")));
+}
+
+static void testErrors() {
+    {
+        clparse::Parser parser(CSTR("test"), CSTR("errors"));
+        auto num = parser.flag<std::int32_t>(CSTR("num"), CSTR('n'), 0, CSTR("a number"));
+        CHECK(num);
+
+        // a flag of an unknown subcommand is not registered
+        auto orphan = parser.flag<bool>(CSTR("x"), NO_SHORT, false, CSTR("x"), CSTR("nosuch"));
+        CHECK(!orphan);
+        CHECK(!orphan.has_value());
+        CHECK(orphan.error().message != nullptr);
+
+        Args args{ CSTR("test"), CSTR("--nosuch") };
+        auto res = parser.parse(args.argc(), args.argv());
+        CHECK(!res);
+        CHECK(res.error().message != nullptr);
+        CHECK(std::strcmp(res.error().message, "Cannot find an appropriate flag") == 0);
+    }
+    {
+        clparse::Parser parser(CSTR("test"), CSTR("errors"));
+        auto num = parser.flag<std::uint8_t>(CSTR("num"), CSTR('n'), 0, CSTR("a number"));
+        CHECK(num);
+
+        Args args{ CSTR("test"), CSTR("--num"), CSTR("12x") };
+        auto res = parser.parse(args.argc(), args.argv());
+        CHECK(!res);
+        CHECK(res.error().message != nullptr);
+        // the message tells which flag has the bad number
+        CHECK(!res && std::strstr(res.error().message, "`--num`") != nullptr);
+    }
+    {
+        clparse::Parser parser(CSTR("test"), CSTR("errors"));
+        auto num = parser.flag<std::int32_t>(CSTR("num"), CSTR('n'), 0, CSTR("a number"));
+        CHECK(num);
+
+        Args args{ CSTR("test"), CSTR("--num") };
+        auto res = parser.parse(args.argc(), args.argv());
+        CHECK(!res);
+        CHECK(res.error().message != nullptr);
+    }
+    {
+        clparse::Parser parser(CSTR("test"), CSTR("errors"));
+        auto a = parser.flag<bool>(CSTR("a"), NO_SHORT, false, CSTR("a"));
+        auto b = parser.flag<bool>(CSTR("b"), NO_SHORT, false, CSTR("b"));
+        CHECK(parser.exclusive({ a->handle(), b->handle() }));
+
+        Args args{ CSTR("test"), CSTR("--a"), CSTR("--b") };
+        auto res = parser.parse(args.argc(), args.argv());
+        CHECK(!res);
+        CHECK(res.error().message != nullptr);
+    }
+}
+
+// every kind of value can take part in constraints, in both kinds of scope
+static void testConstraintHandles() {
+    static const cchar* const modes[] = { CSTR("fast"), CSTR("safe") };
+
+    static const cchar* const scopes[] = { NO_SUBCMD, CSTR("build") };
+
+    for (const cchar* subcmd : scopes) {
+        clparse::Parser parser(CSTR("test"), CSTR("constraints"));
+        auto build = parser.subcmd(CSTR("build"), CSTR("build it"));
+        auto verbose = parser.flag<bool>(CSTR("verbose"), CSTR('v'), false, CSTR("v"), subcmd);
+        auto num = parser.flag<std::uint64_t>(CSTR("num"), NO_SHORT, 0, CSTR("n"), subcmd);
+        auto name = parser.flag<const cchar*>(CSTR("name"), NO_SHORT, nullptr, CSTR("s"), subcmd);
+        auto ids = parser.list<std::int32_t>(CSTR("ids"), NO_SHORT, CSTR("l"), subcmd);
+        auto cpus = parser.range(CSTR("cpus"), NO_SHORT, CSTR("r"), subcmd);
+        auto mode = parser.choice(CSTR("mode"), NO_SHORT, 0, modes, 2, CSTR("c"), subcmd);
+        auto file = parser.mainArg(CSTR("FILE"), CSTR("a file"), subcmd);
+        CHECK(build && verbose && num && name && ids && cpus && mode && file);
+
+        const void* handles[] = {
+            verbose->handle(), num->handle(), name->handle(), ids->handle(), *cpus,
+            mode->handle(),
+        };
+        for (std::size_t i = 0; i < 6; ++i) {
+            CHECK(parser.required(handles[i]));
+            CHECK(parser.depends(handles[i], verbose->handle()));
+            CHECK(parser.exclusive({ handles[i], handles[(i + 1) % 6] }));
+        }
+        // a main argument is not a flag
+        CHECK(!parser.required(file->handle()));
+    }
+}
+
+#ifndef USE_WIDE_ARGV
+// what print writes into a temporary file, or "(failed)" when it returns false
+template <typename F>
+static std::string captured(F print) {
+    std::string output = "(failed)";
+    std::FILE* file = std::tmpfile();
+    if (!file) return output;
+
+    if (print(file)) {
+        char buf[256];
+        std::size_t len;
+
+        output.clear();
+        std::rewind(file);
+        while ((len = std::fread(buf, 1, sizeof(buf), file)) > 0) output.append(buf, len);
+    }
+    std::fclose(file);
+    return output;
+}
+
+static void testCompletion() {
+    {
+        clparse::Parser parser("my-prog.v2", "completion");
+        auto jobs = parser.flag<std::uint32_t>("jobs", 'j', 1, "jobs");
+        auto build = parser.subcmd("build", "build it");
+        auto release = parser.flag<bool>("release", NO_SHORT, false, "release", "build");
+        CHECK(jobs && build && release);
+
+        std::string script = captured([](std::FILE* out) {
+            return clparsePrintCompletionScript("bash", out);
+        });
+        CHECK(script.find("complete -o default -F _my_prog_v2_complete my-prog.v2\n") !=
+              std::string::npos);
+        CHECK(captured([](std::FILE* out) {
+            return clparsePrintCompletionScript("csh", out);
+        }) == "(failed)");
+
+        std::string table = captured([](std::FILE* out) {
+            return clparseDumpCompletionTable("table", out);
+        });
+        CHECK(table.find("{ \"\", \"--jobs\", 1 },") != std::string::npos);
+        CHECK(table.find("{ \"\", \"build\", 0 },") != std::string::npos);
+        CHECK(table.find("{ \"build\", \"--release\", 0 },") != std::string::npos);
+    }
+
+    // a name which a shell would split, expand or run is not written at all
+    static const char* const hostile[] = {
+        "my prog", "$(touch x)", "a;b", "`id`", "it's", "a\"b", "-prog", "",
+    };
+    for (const char* name : hostile) {
+        clparse::Parser parser(name, "completion");
+        for (const char* shell : { "bash", "zsh", "fish" }) {
+            CHECK(captured([shell](std::FILE* out) {
+                return clparsePrintCompletionScript(shell, out);
+            }) == "(failed)");
+        }
+    }
+}
+
+// synthetic UTF-16 argvs, as Windows would hand them over
+static void testArgvToUtf8() {
+    static const std::uint16_t prog[] = { 't', 'e', 's', 't', 0 };
+    static const std::uint16_t flag[] = { '-', '-', 'n', 'a', 'm', 'e', 0 };
+    // a short ASCII run, 2 and 3 bytes characters, and an ASCII run of 5 units
+    static const std::uint16_t name[] = { 'a', 0xE9, 0x20AC, 'b', 'c', 'd', 'e', 'f', 0 };
+    // a surrogate pair (U+1F600), and lone high and low surrogates (WTF-8)
+    static const std::uint16_t file[] = { 0xD83D, 0xDE00, 'x', 0xD800, 'y', 0xDC00, 0 };
+    static const std::uint16_t* const wargv[] = { prog, flag, name, file };
+
+    char** argv = clparseArgvToUtf8(4, wargv);
+    CHECK(argv != nullptr);
+    if (!argv) return;
+
+    CHECK(std::strcmp(argv[0], "test") == 0);
+    CHECK(std::strcmp(argv[1], "--name") == 0);
+    CHECK(std::strcmp(argv[2], "a\xC3\xA9\xE2\x82\xAC" "bcdef") == 0);
+    CHECK(std::strcmp(argv[3], "\xF0\x9F\x98\x80x\xED\xA0\x80y\xED\xB0\x80") == 0);
+    CHECK(argv[4] == nullptr);
+
+    {
+        clparse::Parser parser(CSTR("test"), CSTR("utf-8"));
+        auto parsed_name = parser.flag<const cchar*>(CSTR("name"), NO_SHORT, nullptr, CSTR("a name"));
+        auto parsed_file = parser.mainArg(CSTR("FILE"), CSTR("a file"));
+        CHECK(parsed_name && parsed_file);
+
+        CHECK(parser.parse(4, argv));
+        CHECK(parsed_name->get() == clparse::StringView(argv[2]));
+        CHECK(parsed_file->get() == clparse::StringView(argv[3]));
+    }
+
+    clparseFreeArgvUtf8(argv);
+}
+#endif // USE_WIDE_ARGV
+
+static void testExpected() {
+    struct NoDefault {
+        explicit NoDefault(int value) : value(value) {}
+        int value;
+    };
+
+    clparse::Expected<NoDefault> ok(NoDefault(3));
+    clparse::Expected<NoDefault> err(clparse::Error{ "failed" });
+    CHECK(ok && ok->value == 3);
+    CHECK(!err && std::strcmp(err.error().message, "failed") == 0);
+}
+
+static void testMove() {
+    clparse::Parser parser(CSTR("test"), CSTR("move"));
+    auto num = parser.flag<std::int32_t>(CSTR("num"), CSTR('n'), 0, CSTR("a number"));
+
+    // the moved-from parser must not deinit clparse
+    clparse::Parser moved(std::move(parser));
+    { clparse::Parser dropped(std::move(moved)); parser = std::move(dropped); }
+
+    Args args{ CSTR("test"), CSTR("-n"), CSTR("3") };
+    CHECK(parser.parse(args.argc(), args.argv()));
+    CHECK(num->get() == 3);
+}
+
+#if defined(__cpp_impl_coroutine) && defined(__cpp_lib_coroutine)
+static void testEvents() {
+    clparse::Parser parser(CSTR("test"), CSTR("events"));
+    auto verbose = parser.flag<bool>(CSTR("verbose"), CSTR('v'), false, CSTR("verbose"));
+    auto ids = parser.list<std::uint32_t>(CSTR("ids"), CSTR('i'), CSTR("ids"));
+    CHECK(verbose && ids);
+
+    Args args{ CSTR("test"), CSTR("-v"), CSTR("file"), CSTR("--ids"), CSTR("1,2"),
+               CSTR("3"), CSTR("--"), CSTR("-x") };
+
+    struct Expected {
+        ClparseEventKind kind;
+        const cchar* value;
+    };
+    const Expected expected[] = {
+        { CLPARSE_EVENT_FLAG, nullptr },
+        { CLPARSE_EVENT_POSITIONAL, CSTR("file") },
+        { CLPARSE_EVENT_FLAG, CSTR("1") },
+        { CLPARSE_EVENT_FLAG, CSTR("2") },
+        { CLPARSE_EVENT_FLAG, CSTR("3") },
+        { CLPARSE_EVENT_PASSTHROUGH, CSTR("-x") },
+    };
+
+    std::size_t count = 0;
+    for (const ClparseEvent& event : clparse::events(args.argc(), args.argv())) {
+        if (count >= sizeof(expected) / sizeof(expected[0])) {
+            ++count;
+            break;
+        }
+        const Expected& exp = expected[count++];
+        CHECK(event.kind == exp.kind);
+        if (exp.value) {
+            CHECK(clparse::StringView(event.value, event.value_len) == clparse::StringView(exp.value));
+        } else {
+            CHECK(event.value == nullptr);
+        }
+        if (event.kind == CLPARSE_EVENT_FLAG) {
+            CHECK(event.handle == (exp.value ? static_cast<const void*>(ids->handle())
+                                             : static_cast<const void*>(verbose->handle())));
+        }
+    }
+    CHECK(count == sizeof(expected) / sizeof(expected[0]));
+
+    // a list given with `=` takes no more tokens, as clparseParse does
+    Args inline_args{ CSTR("test"), CSTR("--ids=1,2"), CSTR("3") };
+    const ClparseEventKind inline_expected[] = {
+        CLPARSE_EVENT_FLAG, CLPARSE_EVENT_FLAG, CLPARSE_EVENT_POSITIONAL,
+    };
+    count = 0;
+    for (const ClparseEvent& event : clparse::events(inline_args.argc(), inline_args.argv())) {
+        if (count >= 3) {
+            ++count;
+            break;
+        }
+        CHECK(event.kind == inline_expected[count++]);
+    }
+    CHECK(count == 3);
+
+    // an error is the last event
+    Args bad{ CSTR("test"), CSTR("--nosuch"), CSTR("-v") };
+    ClparseEventKind last = CLPARSE_EVENT_END;
+    count = 0;
+    for (const ClparseEvent& event : clparse::events(bad.argc(), bad.argv())) {
+        last = event.kind;
+        ++count;
+    }
+    CHECK(count == 1);
+    CHECK(last == CLPARSE_EVENT_ERROR);
+}
+#endif // __cpp_impl_coroutine
+
+int main() {
+    testParseInteger();
+    testValues();
+    testDefaults();
+    testLists();
+    testParseAgain();
+    testChoiceAndSubcmd();
+    testErrors();
+    testConstraintHandles();
+#ifndef USE_WIDE_ARGV
+    testCompletion();
+    testArgvToUtf8();
+#endif // USE_WIDE_ARGV
+    testExpected();
+    testMove();
+#if defined(__cpp_impl_coroutine) && defined(__cpp_lib_coroutine)
+    testEvents();
+#endif // __cpp_impl_coroutine
+
+    if (failed > 0) {
+        std::fprintf(stderr, "%d check(s) failed\n", failed);
+        return 1;
+    }
+    std::printf("All tests passed\n");
+    return 0;
+}